@@ -24,51 +24,46 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
+#include "wheel.h"
+
 
 #define LED_DDR		DDRB
 #define LED_PORT	PORTB
 #define LED_PIN		PB5
 
-#define BLINK_INTERVAL	15630
-
-
-static void
-init_timer1(void)
-{
-	/*
-	 * Set the waveform generation mode to CTC with OCR1A as the
-	 * top value.
-	 */
-	TCCR1B |= _BV(WGM12);
+/* The LED is toggled every BLINK_INTERVAL milliseconds. */
+#define BLINK_INTERVAL	1000
 
-	/* Use a prescaler of 1024. */
-	TCCR1B |= _BV(CS12) | _BV(CS10);
 
-	/* Trigger an interrupt on output compare A. */
-	TIMSK1 |= _BV(OCIE1A);
+/*
+ * Rather than give all of Timer1 over to the LED, the blink is one of
+ * the wheel's software timers; any number of others could share the
+ * same hardware timer alongside it.
+ */
+static struct wheel_timer	blink;
 
-	/* Set the output compare register to the update interval. */
-	OCR1A = BLINK_INTERVAL;
 
-	/* Enable interrupts. */
-	sei();
+static void
+toggle_led(void *arg)
+{
+	LED_PORT ^= _BV(LED_PIN);
 }
 
 
 int
 main(void)
 {
-	init_timer1();
-
 	LED_DDR |= _BV(LED_PIN);
 
-	while (1) {}
+	wheel_init();
+	wheel_timer_init(&blink, toggle_led, NULL);
+	wheel_start(&blink, WHEEL_TICKS(BLINK_INTERVAL),
+	    WHEEL_TICKS(BLINK_INTERVAL));
 
-	return 0;
-}
+	/* Enable interrupts. */
+	sei();
 
+	while (1) {}
 
-ISR(TIMER1_COMPA_vect)
-{
-	LED_PORT ^= _BV(LED_PIN);
+	return 0;
 }
@@ -23,283 +23,719 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
-#include <util/setbaud.h>
+#include <avr/pgmspace.h>
 
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "clock.h"
+#include "event.h"
+#include "fmt.h"
+#include "serial.h"
+#include "snapshot.h"
+#include "telemetry.h"
 
-#define STROBE_DDR	DDRB
-#define STROBE_PORT	PORTB
-#define STROBE_PIN	PB4
+
+/*
+ * With STROBE_HW_CARRIER set, the 38 kHz carrier is generated by Timer2's
+ * compare output on OC2A (PB3) instead of by toggling a pin from an
+ * interrupt.
+ */
+#ifndef STROBE_HW_CARRIER
+#define STROBE_HW_CARRIER	0
+#endif
+
+/*
+ * STROBE_CHANNELS is the number of emitters in use, taken from the
+ * front of the emitter table below.
+ */
+#ifndef STROBE_CHANNELS
+#define STROBE_CHANNELS		1
+#endif
+
+/*
+ * Building with STROBE_PROFILE set reports how much of the time the CPU
+ * spends awake, interrupts included, once a second. The report is text,
+ * so it can't be used along with TELEMETRY. The carrier interrupt is
+ * too short to be sampled well, so use HW_CARRIER for a fair figure.
+ */
+#ifndef STROBE_PROFILE
+#define STROBE_PROFILE		0
+#endif
+
+#if STROBE_PROFILE && TELEMETRY
+#error "STROBE_PROFILE reports as text, and can't be used with TELEMETRY."
+#endif
+
+#define CARRIER_DDR	DDRB
+#define CARRIER_PIN	PB3
 
 #define IND_DDR		DDRB
 #define IND_PORT	PORTB
 #define IND_PIN		PB5
 
+/*
+ * The receivers must all be on port D, which is PCINT bank 2.
+ */
 #define RCV_DDR		DDRD
 #define RCV_PORT	PORTD
-#define RCV_PIN		PD2
+#define RCV_PINS	PIND
 
 
 /*
- * A 38 kHz cycle requires the strobe is toggled every 13ms; multiplied
- * by two cycles per microsecond yields 26.
+ * An emitter is one channel of the proximity array: an IR LED and the
+ * receiver that watches for its reflection. Several emitters may share
+ * a receiver. In software carrier mode, pin drives the LED directly. In
+ * hardware carrier mode, every LED is fed the carrier from OC2A, and
+ * pin selects which one lights: it is held low for the active emitter
+ * and high for the rest.
  */
-#define STROBE_CYCLE	26
+struct emitter {
+	volatile uint8_t	*port;
+	volatile uint8_t	*ddr;
+	uint8_t			 pin;
+	uint8_t			 receiver;	/* pin on port D */
+};
+
+#define EMITTER_TABLE	4
+
+static const struct emitter	emitters[EMITTER_TABLE] = {
+	{&PORTB, &DDRB, PB4, PD2},
+	{&PORTB, &DDRB, PB2, PD2},
+	{&PORTB, &DDRB, PB1, PD2},
+	{&PORTB, &DDRB, PB0, PD2},
+};
+
+#if STROBE_CHANNELS < 1 || STROBE_CHANNELS > EMITTER_TABLE
+#error "STROBE_CHANNELS must be between 1 and the size of the emitter table."
+#endif
+
 
 /*
- * We'll perform 76 toggles: this turns out to be right around 1.1ms. This
- * is 1000 microseconds (1 millisecond) divided by 13 microseconds per
- * toggle. This gives us 77 ticks, but we'll subtract one to account for
- * minor delays in processing. An even number also ensures we end with the
- * strobe off; this could also be accomplished by explicitly turning the
- * strobe off at the end.
+ * Timer1 runs freely with a prescaler of 8, which gives two ticks per
+ * microsecond. Everything is scheduled by setting a compare register to
+ * an absolute time, so interrupt latency never accumulates into the
+ * timing.
  */
-#define MAX_TICKS	74
+#define TICKS_PER_US	2
 
+#if STROBE_HW_CARRIER
+/*
+ * In hardware carrier mode, Timer2 runs in CTC mode with no prescaling
+ * and toggles OC2A every time it reaches OCR2A. This gives a carrier of
+ * F_CPU / (2 * (STROBE_OCR2A + 1)), or 38.1 kHz at 16 MHz, with no
+ * software involved at all.
+ */
+#define STROBE_OCR2A	((F_CPU / (2UL * 38000UL)) - 1)
+#define CARRIER_CLOCKS	(2UL * (STROBE_OCR2A + 1))
+#else
+/*
+ * A 38 kHz cycle requires the strobe is toggled every 13us; multiplied
+ * by two ticks per microsecond yields 26. The toggling is done by
+ * Timer1's compare A interrupt.
+ */
+#define STROBE_CYCLE	(13 * TICKS_PER_US)
+#define CARRIER_CLOCKS	(2UL * STROBE_CYCLE * 8)
+#endif
 
-#define toggle_bit(port, pin)	port ^= _BV(pin)
+#define CYCLES_TO_TICKS(n)	((uint16_t)(((n) * CARRIER_CLOCKS) / 8))
 
 
 /*
- * init_UART brings up the serial port.
+ * The scan timing is dictated by the IR receiver. It needs a burst of
+ * at least ten carrier cycles to respond, and its output lags the
+ * carrier by up to about ten cycles, so the receiver is still watched
+ * for STROBE_SETTLE_CYCLES after the burst ends. Its gain control
+ * needs the carrier to be off for STROBE_GAP_RATIO times as long as it
+ * was on, and it can't take more than STROBE_MAX_BURSTS bursts per
+ * second.
+ *
+ * Each scan is a burst on one channel, followed by a gap. The channels
+ * take turns, and the gap is only as long as the next channel's
+ * receiver needs. Channels sharing a receiver get one scan every 1.6ms
+ * between them with the defaults, just over 600 Hz; channels on
+ * different receivers only have to wait out the settle window and
+ * STROBE_MIN_GAP_CYCLES, so they overlap the others' recovery time.
+ */
+#define STROBE_BURST_CYCLES	20
+#define STROBE_SETTLE_CYCLES	10
+#define STROBE_MIN_GAP_CYCLES	2
+#define STROBE_GAP_RATIO	2
+#define STROBE_MAX_BURSTS	800
+
+#define STROBE_SCAN_CYCLES	(STROBE_BURST_CYCLES * (1 + STROBE_GAP_RATIO))
+
+#if STROBE_BURST_CYCLES < 10
+#error "The receiver needs bursts of at least 10 carrier cycles."
+#endif
+
+#if STROBE_SETTLE_CYCLES >= (STROBE_BURST_CYCLES * STROBE_GAP_RATIO)
+#error "The settle window must fit inside the gap."
+#endif
+
+#if (STROBE_SCAN_CYCLES * CARRIER_CLOCKS * STROBE_MAX_BURSTS) < F_CPU
+#error "The scan rate is faster than the receiver can keep up with."
+#endif
+
+/*
+ * A real reflection holds the receiver's output low for about as long
+ * as the burst, while noise tends to show up as short glitches. A scan
+ * only counts as a detection if the output was low for at least
+ * STROBE_MIN_LOW_CYCLES in total; setting it to zero makes any edge at
+ * all a detection.
+ */
+#define STROBE_MIN_LOW_CYCLES	(STROBE_BURST_CYCLES / 2)
+
+#define BURST_TICKS	CYCLES_TO_TICKS(STROBE_BURST_CYCLES)
+#define SETTLE_TICKS	CYCLES_TO_TICKS(STROBE_SETTLE_CYCLES)
+#define MIN_GAP_TICKS	CYCLES_TO_TICKS(STROBE_MIN_GAP_CYCLES)
+#define RECOVER_TICKS	CYCLES_TO_TICKS(STROBE_BURST_CYCLES * STROBE_GAP_RATIO)
+#define MIN_LOW_TICKS	CYCLES_TO_TICKS(STROBE_MIN_LOW_CYCLES)
+
+
+/*
+ * The scan states. A scan starts with the carrier on in SCAN_BURST.
+ * In SCAN_SETTLE, the carrier is off but the receiver is still being
+ * watched; at the end of it, the result is published. SCAN_GAP waits
+ * until the next channel's receiver is ready for another burst.
+ */
+#define SCAN_BURST	0
+#define SCAN_SETTLE	1
+#define SCAN_GAP	2
+
+static volatile uint8_t	scan_state = SCAN_GAP;
+
+
+/*
+ * The channel being scanned, and the bits it uses, cached so that the
+ * interrupts don't have to go back to the emitter table.
+ */
+static uint8_t		 channel = STROBE_CHANNELS - 1;
+static volatile uint8_t	*emitter_port;
+static uint8_t		 emitter_mask;
+static volatile uint8_t	 rcv_mask;
+
+
+/*
+ * rcv_ready holds, for each pin on port D, the Timer1 count at which
+ * that receiver will have recovered from its last burst. With at most
+ * EMITTER_TABLE channels, every receiver is used well within one
+ * Timer1 period, so the counts can be compared across wraparound.
+ */
+static uint16_t		rcv_ready[8];
+
+
+/*
+ * A scan_result describes what a channel's receiver did during a scan.
+ * Every edge is timestamped against the start of the burst: latency is
+ * the time to the first falling edge (or NO_RESPONSE if there wasn't
+ * one), pulses counts the falling edges, and low_ticks is the total
+ * time the output spent low. All times are in Timer1 ticks.
+ */
+#define NO_RESPONSE	0xFFFF
+
+struct scan_result {
+	uint8_t		channel;
+	bool		detected;
+	uint8_t		pulses;
+	uint16_t	latency;
+	uint16_t	low_ticks;
+};
+
+
+/*
+ * The edge capture state for the current scan. burst_start is the
+ * Timer1 count the burst started at, and fell_at is when the output
+ * last went low, relative to it.
+ */
+static volatile struct scan_result	scan;
+static volatile uint16_t		burst_start = 0;
+static volatile uint16_t		fell_at = 0;
+static volatile bool			rcv_low = false;
+
+
+/*
+ * The detection state is built up by the scheduler as each scan
+ * finishes, and read by the main program as a snapshot. detected has a
+ * bit set for each channel whose last scan found an object, cycles
+ * counts the scans of every channel, stamp is the low 16 bits of
+ * millis() when the last of them finished, and each channel has a count of
+ * the scans that found an object and the receiver's response latency
+ * and low time, in ticks, from its last scan.
+ */
+struct strobe_state {
+	uint8_t		detected;
+	uint16_t	cycles;
+	uint16_t	stamp;
+	uint16_t	hits[STROBE_CHANNELS];
+	uint16_t	latency[STROBE_CHANNELS];
+	uint16_t	low_ticks[STROBE_CHANNELS];
+};
+
+static volatile struct strobe_state	state;
+static struct snapshot			state_snap;
+
+static void	cycle_done(uint8_t unused);
+
+
+/*
+ * How often a telemetry frame is sent when nothing changes, in scan
+ * cycles (one scan of every channel).
+ */
+#define STROBE_REPORT_EVERY	64
+
+
+/*
+ * emitter_off makes sure an emitter isn't lit.
  */
 static void
-init_UART(void)
+emitter_off(const struct emitter *e)
 {
-	/*
-	 * The UBRR register is a UART baud rate register. We're using
-	 * UART 0. It's a 16-bit register, and we need to set the high
-	 * and low bytes to the values automatically provided for us by
-	 * the util/setbaud.h header.
-	 */
-	UBRR0H = UBRRH_VALUE;
-	UBRR0L = UBRRL_VALUE;
+#if STROBE_HW_CARRIER
+	*e->port |= _BV(e->pin);
+#else
+	*e->port &= ~_BV(e->pin);
+#endif
+}
 
-	/*
-	 * UART control status registers (or UCSR0 for UART 0) control
-	 * the UART's operation. There are three such registers, labeled
-	 * A, B, and C.
-	 */
 
-	/*
-	 * In UCSR0A, we want to disable 2x transmission speed.
-	 */
-	UCSR0A &= ~(1 << U2X0);
+static void
+carrier_on(void)
+{
+#if STROBE_HW_CARRIER
+	/* Select the emitter. */
+	*emitter_port &= ~emitter_mask;
+
+	/* Connect OC2A, toggling on every compare match, and start. */
+	TCNT2 = 0;
+	TCCR2A = _BV(COM2A0) | _BV(WGM21);
+	TCCR2B = _BV(CS20);
+#else
+	/* Start toggling the emitter from the compare A interrupt. */
+	OCR1A = TCNT1 + STROBE_CYCLE;
+	TIFR1 = _BV(OCF1A);
+	TIMSK1 |= _BV(OCIE1A);
+#endif
+}
 
-	/*
-	 * Enable the transmitter (transmit enable 0) and receiver
-	 * (receive enable 0).
-	 */
-	UCSR0B = ((1 << TXEN0)|(1 << RXEN0));
 
+static void
+carrier_off(void)
+{
+#if STROBE_HW_CARRIER
 	/*
-	 * Now, we set the framing to the most common format: 8 data bits,
-	 * one stop bit.
+	 * Stop Timer2, and force a compare match with OC2A set to clear
+	 * so that the carrier always ends (and the next one starts) low.
+	 * Once it is disconnected, the pin goes back to the PORTB bit,
+	 * which is never set.
 	 */
-	UCSR0C = ((1 << UCSZ01)|(1 << UCSZ00));
+	TCCR2A = _BV(COM2A1) | _BV(WGM21);
+	TCCR2B = _BV(FOC2A);
+	TCCR2A = _BV(WGM21);
+
+	/* Deselect the emitter. */
+	*emitter_port |= emitter_mask;
+#else
+	TIMSK1 &= ~_BV(OCIE1A);
+	*emitter_port &= ~emitter_mask;
+#endif
 }
 
 
 /*
- * write_string writes the string to the serial port.
+ * next_channel moves on to the next emitter and returns the Timer1
+ * count at which its burst can start: after the minimum gap, and once
+ * its receiver has recovered.
  */
-static void
-write_string(char *s)
+static uint16_t
+next_channel(uint16_t now)
 {
-	int	i = 0;
+	const struct emitter	*e;
+	uint16_t		 start = now + MIN_GAP_TICKS;
+	uint16_t		 ready;
 
-	while (s[i] != 0) {
-		loop_until_bit_is_set(UCSR0A, UDRE0);
-		UDR0 = s[i];
-		i++;
+	channel++;
+	if (channel == STROBE_CHANNELS) {
+		channel = 0;
 	}
+
+	e = &emitters[channel];
+	emitter_port = e->port;
+	emitter_mask = _BV(e->pin);
+	rcv_mask = _BV(e->receiver);
+
+	ready = rcv_ready[e->receiver];
+	if ((int16_t)(ready - start) > 0) {
+		start = ready;
+	}
+
+	return start;
 }
 
 
 /*
- * serial_read blocks until a character is available from the UART,
- * returning that character when it is received.
+ * setup_strobe prepares the timers and PCINT2 for use, sets up the
+ * relevant pins, and starts scanning.
  */
-char
-serial_read(void)
+static void
+setup_strobe(void)
 {
+	uint8_t	i;
+
+#if STROBE_HW_CARRIER
 	/*
-	 * Similar to the write_string function, UCSR0A's RXC0 bit will
-	 * be set when a byte is ready to be read from the serial port.
+	 * Timer2 is put in CTC mode with OCR2A as the top value, but
+	 * isn't clocked until the strobe is fired.
 	 */
-	loop_until_bit_is_set(UCSR0A, RXC0);
+	TCCR2A = _BV(WGM21);
+	TCCR2B = 0;
+	OCR2A = STROBE_OCR2A;
+	CARRIER_DDR |= _BV(CARRIER_PIN);
+#endif
+
+	/* Timer1 runs in normal mode with a prescaler of 8. */
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+
+	/*
+	 * Set up the emitter pins, and enable the pullup resistor on
+	 * each receiver's pin.
+	 */
+	for (i = 0; i < STROBE_CHANNELS; i++) {
+		emitter_off(&emitters[i]);
+		*emitters[i].ddr |= _BV(emitters[i].pin);
+		RCV_PORT |= _BV(emitters[i].receiver);
+		rcv_ready[emitters[i].receiver] = TCNT1;
+	}
+	IND_DDR |= _BV(IND_PIN);
 
 	/*
-	 * The contents of the UDR0 register have the byte that was
-	 * read in.
+	 * Start with a gap, which leads into the first burst on the
+	 * first channel.
 	 */
-	return UDR0;
+	scan_state = SCAN_GAP;
+	OCR1B = next_channel(TCNT1 + RECOVER_TICKS);
+	TIFR1 = _BV(OCF1B);
+	TIMSK1 |= _BV(OCIE1B);
 }
 
 
 /*
- * newline sends a CR-LF over the serial port.
+ * start_capture resets the edge capture state at the start of a burst.
  */
 static void
-newline(void)
+start_capture(uint16_t now)
 {
-	loop_until_bit_is_set(UCSR0A, UDRE0);
-	UDR0 = '\r';
-
-	loop_until_bit_is_set(UCSR0A, UDRE0);
-	UDR0 = '\n';
+	burst_start = now;
+	scan.channel = channel;
+	scan.pulses = 0;
+	scan.latency = NO_RESPONSE;
+	scan.low_ticks = 0;
+	fell_at = 0;
+	rcv_low = !(RCV_PINS & rcv_mask);
 }
 
 
-
 /*
- * setup_strobe prepares Timer1 and PCINT2 for use, and sets up the
- * relevant pins.
+ * publish finishes off the current scan, decides whether it found an
+ * object, and adds it to the detection state.
  */
 static void
-setup_strobe(void)
+publish(uint16_t now)
 {
-	/* The timer should be in CTC mode. */
-	TCCR1A |= _BV(WGM11);
+	uint8_t	bit = _BV(scan.channel);
 
-	/* Use a prescaler of 8. */
-	TCCR1B |= _BV(CS11);
+	/* Count a low period still running at the end of the window. */
+	if (rcv_low) {
+		scan.low_ticks += (uint16_t)(now - burst_start) - fell_at;
+	}
 
-	TCNT1 = 0;	/* Reset the counter. */
-	TIFR1 |= _BV(OCF1A);
-	TIMSK1 |= _BV(OCIE1A);
+	scan.detected = (scan.pulses > 0) && (scan.low_ticks >= MIN_LOW_TICKS);
 
-	/* Enable only PCINT18 in the PCINT2 register. */
-	PCMSK2 = _BV(PCINT18);
+	snapshot_write_begin(&state_snap);
+	state.latency[scan.channel] = scan.latency;
+	state.low_ticks[scan.channel] = scan.low_ticks;
+	if (scan.detected) {
+		state.detected |= bit;
+		state.hits[scan.channel]++;
+	}
+	else {
+		state.detected &= ~bit;
+	}
 
-	/* Set up the pins. */
-	STROBE_DDR |= _BV(STROBE_PIN);
-	IND_DDR |= _BV(IND_PIN);
+	if (scan.channel == (STROBE_CHANNELS - 1)) {
+		state.cycles++;
+		state.stamp = (uint16_t)millis();
+	}
+	snapshot_write_end(&state_snap);
 
-	/*
-	 * The default for a port is to be in input mode. However,
-	 * the pullup resistor needs to be enabled.
-	 */
-	RCV_PORT |= _BV(RCV_PIN);
-	sei();
+	if (scan.channel == (STROBE_CHANNELS - 1)) {
+		event_post(cycle_done, 0);
+	}
 }
 
 
 /*
- * alarm is set to true if the IR strobe detected an object. It is
- * reset each time the strobe is fired.
+ * get_state copies out the detection state, trying again if a scan
+ * finishes while the copy is being made.
  */
-static volatile bool	alarm = false;
-
 static void
-strobe(void)
+get_state(struct strobe_state *copy)
 {
-	/* Enable PCINT18. */
-	PCIFR |= _BV(PCIF2);	/* Drop any pending interrupts. */
-	PCICR |= _BV(PCIE2);	/* Enable PC interrupt bank 2. */
-
-	/* Reset the alarm. */
-	alarm = false;
+	uint8_t	seq, i;
+
+	do {
+		seq = snapshot_read_begin(&state_snap);
+		copy->detected = state.detected;
+		copy->cycles = state.cycles;
+		copy->stamp = state.stamp;
+		for (i = 0; i < STROBE_CHANNELS; i++) {
+			copy->hits[i] = state.hits[i];
+			copy->latency[i] = state.latency[i];
+			copy->low_ticks[i] = state.low_ticks[i];
+		}
+	} while (snapshot_read_retry(&state_snap, seq));
+}
 
-	/* Reset Timer1. */
-	TCNT1 = 0;		/* Reset the counter. */
-	TIMSK1 |= _BV(OCIE1A);	/* Drop any pending interrupts. */
-	OCR1A = STROBE_CYCLE;
 
-	/*
-	 * Activate Timer0. PRR is the power-reduction register; any
-	 * cleared timer bits will enable that timer, while any set
-	 * bits will disable it.
-	 */
-	PRR &= ~_BV(PRTIM1);
+/*
+ * The scheduler ISR runs at every change of scan state, moving through
+ * burst, settle and gap in turn for each channel. It is the only place
+ * the scan is driven from; the main program never waits on it.
+ */
+ISR(TIMER1_COMPB_vect)
+{
+	switch (scan_state) {
+	case SCAN_BURST:
+		carrier_off();
+		rcv_ready[emitters[channel].receiver] = OCR1B + RECOVER_TICKS;
+		OCR1B += SETTLE_TICKS;
+		scan_state = SCAN_SETTLE;
+		break;
+	case SCAN_SETTLE:
+		PCICR &= ~_BV(PCIE2);	/* Disable PCINT2. */
+		publish(OCR1B);
+		OCR1B = next_channel(OCR1B);
+		scan_state = SCAN_GAP;
+		break;
+	default:
+		start_capture(OCR1B);
+		PCMSK2 = rcv_mask;	/* Watch only this receiver. */
+		PCIFR = _BV(PCIF2);	/* Drop any pending interrupts. */
+		PCICR |= _BV(PCIE2);	/* Enable PC interrupt bank 2. */
+		carrier_on();
+		OCR1B += BURST_TICKS;
+		scan_state = SCAN_BURST;
+		break;
+	}
 }
 
 
+#if !STROBE_HW_CARRIER
 /*
- * The strobe's ISR handles setting up the 38kHz strobe and triggering
- * it for roughly 10ms.
+ * In software carrier mode, the compare A ISR toggles the active
+ * emitter every half cycle during a burst.
  */
 ISR(TIMER1_COMPA_vect)
 {
-	static uint8_t	ticks = 0;
+	*emitter_port ^= emitter_mask;
+	OCR1A += STROBE_CYCLE;
+}
+#endif
 
-	/*
-	 * Once we've reached the maximum number of ticks, stop
-	 * the timer and disable the port change interrupt.
-	 */
-	if (ticks == MAX_TICKS) {
-		PRR |= _BV(PRTIM1);	/* Put Timer0 in powersave mode. */
-		PCICR &= ~_BV(PCIE2);	/* Disable PCINT2. */
-		PCIFR |= _BV(PCIF2);	/* Drop pending PCINT2 interrupts. */
 
-		ticks = 0;		/* Reset tick counter. */
+/*
+ * A receiver's output goes low while it sees the carrier reflected
+ * back. Each change during a scan is timestamped from the free-running
+ * Timer1 count, building up the pulse count and low time that decide
+ * whether the scan found an object.
+ */
+ISR(PCINT2_vect)
+{
+	uint16_t	now = TCNT1 - burst_start;
+
+	if (!(RCV_PINS & rcv_mask)) {
+		if (!rcv_low) {
+			rcv_low = true;
+			fell_at = now;
+			if (scan.pulses == 0) {
+				scan.latency = now;
+			}
+			if (scan.pulses < 255) {
+				scan.pulses++;
+			}
+		}
 	}
-	/*
-	 * Otherwise, toggle the strobe and increase the tick count.
-	 */
-	else {
-		toggle_bit(STROBE_PORT, STROBE_PIN);
+	else if (rcv_low) {
+		rcv_low = false;
+		scan.low_ticks += now - fell_at;
+	}
+}
 
-		/* Reset the timer count and trigger on next cycle. */
-		TCNT1 = 0;
-		OCR1A = STROBE_CYCLE;
-		ticks++;
+
+/*
+ * carrier_cycles converts a receiver's latency or low time into carrier
+ * cycles, saturating at 255 so that it fits in a byte. A scan with no
+ * response has a latency of 255.
+ */
+static uint8_t
+carrier_cycles(uint16_t ticks)
+{
+	uint16_t	cycles = ticks / CYCLES_TO_TICKS(1);
+
+	return cycles > 255 ? 255 : (uint8_t)cycles;
+}
+
+
+#if TELEMETRY
+/*
+ * send_cycle streams the detection state to the host as a telemetry
+ * frame.
+ */
+static void
+send_cycle(const struct strobe_state *st)
+{
+	uint8_t	payload[TELEMETRY_STROBE_SIZE(STROBE_CHANNELS)];
+	uint8_t	i;
+
+	payload[0] = st->detected;
+	payload[1] = (uint8_t)st->cycles;
+	payload[2] = (uint8_t)(st->cycles >> 8);
+	payload[3] = STROBE_CHANNELS;
+	for (i = 0; i < STROBE_CHANNELS; i++) {
+		payload[4 + i] = carrier_cycles(st->low_ticks[i]);
+		payload[4 + STROBE_CHANNELS + i] =
+		    carrier_cycles(st->latency[i]);
 	}
+
+	telemetry_send(TELEMETRY_STROBE, st->stamp, payload,
+	    sizeof(payload));
 }
+#endif
 
 
 /*
- * If the receiver pin changes, it's a transition from high to low, so
- * the alarm needs to be set.
+ * The main program's view of the scans: the last cycle it dealt with,
+ * the detections it last reported, and, in telemetry mode, the cycle it
+ * last sent a frame for.
  */
-ISR(PCINT2_vect)
+static uint16_t	last_cycle = 0;
+static uint8_t	reported = 0;
+#if TELEMETRY
+static uint16_t	sent = 0;
+#endif
+#if STROBE_PROFILE
+static uint32_t	profile_due;
+#endif
+
+
+/*
+ * cycle_done is run from the event loop once a scan cycle finishes. If
+ * the main program falls behind, it simply sees the latest state; the
+ * hit counts still include every scan.
+ */
+static void
+cycle_done(uint8_t unused)
 {
-	alarm = true;
+	struct strobe_state	st;
+#if !TELEMETRY
+	uint8_t			i;
+#endif
+
+	get_state(&st);
+	if (st.cycles == last_cycle) {
+		return;
+	}
+	last_cycle = st.cycles;
+
+	/*
+	 * The indicator LED is lit if any channel sees an object.
+	 */
+	if (st.detected) {
+		IND_PORT |= _BV(IND_PIN);
+	}
+	else {
+		IND_PORT &= ~_BV(IND_PIN);
+	}
+
+	/*
+	 * Scan cycles come in far too quickly to report every one, so
+	 * only changes are reported (along with a regular heartbeat in
+	 * telemetry mode).
+	 */
+#if TELEMETRY
+	if ((st.detected != reported) ||
+	    (uint16_t)(st.cycles - sent) >= STROBE_REPORT_EVERY) {
+		send_cycle(&st);
+		sent = st.cycles;
+	}
+#else
+	if (st.detected != reported) {
+		write_string_P(PSTR("detections: "));
+		write_hex(st.detected, 2);
+		write_string_P(PSTR(", low:"));
+		for (i = 0; i < STROBE_CHANNELS; i++) {
+			serial_write(' ');
+			write_uint(carrier_cycles(st.low_ticks[i]), 0);
+		}
+		write_string_P(PSTR(", latency:"));
+		for (i = 0; i < STROBE_CHANNELS; i++) {
+			serial_write(' ');
+			if (st.latency[i] == NO_RESPONSE) {
+				serial_write('-');
+			}
+			else {
+				write_uint(st.latency[i] / TICKS_PER_US, 0);
+			}
+		}
+		write_string_P(PSTR(", hits:"));
+		for (i = 0; i < STROBE_CHANNELS; i++) {
+			serial_write(' ');
+			write_uint(st.hits[i], 0);
+		}
+		newline();
+	}
+#endif
+	reported = st.detected;
+
+#if STROBE_PROFILE
+	if ((int32_t)(millis() - profile_due) >= 0) {
+		profile_due += 1000;
+		write_string_P(PSTR("awake: "));
+		write_fixed(event_awake(), 0, 1);
+		serial_write('%');
+		newline();
+	}
+#endif
 }
 
 
 int
 main(void)
 {
+	clock_init();
 	init_UART();
 	setup_strobe();
+
+	/*
+	 * In telemetry mode, the boot message is left out, as it would
+	 * only be noise to the host's decoder.
+	 */
+#if !TELEMETRY
 	write_string("Boot OK.");
 	newline();
+#endif
 
 	sei();
 
-	while (1) {
-		strobe();
-
-		/*
-		 * Give the strobe time to register its results.
-		 */
-		_delay_ms(20);
-
-		/*
-		 * If the alarm has been triggered, turn on the indicator
-		 * LED.
-		 */
-		if (alarm) {
-			write_string("object detected");
-			newline();
-			IND_PORT |= _BV(IND_PIN);
-		}
-		/*
-		 * Otherwise, make sure the LED is off.
-		 */
-		else {
-			IND_PORT &= ~_BV(IND_PIN);
-		}
-
-		/*
-		 * Finish delaying for 100ms.
-		 */
-		_delay_ms(80);
-	}
+	/*
+	 * Everything from here on is run from the scan interrupts; the
+	 * main program sleeps between scan cycles.
+	 */
+#if STROBE_PROFILE
+	profile_due = millis() + 1000;
+#endif
+	event_loop();
 
 	return 0;
 }
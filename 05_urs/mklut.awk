@@ -0,0 +1,44 @@
+# mklut.awk generates urs_lut.h, the table urs.c uses to turn ADC
+# readings into distances. The table maps the voltage on the URS input,
+# from 0 up to full millivolts, to millimetres in 2^bits equal segments;
+# urs.c interpolates linearly between the entries. The sensor is
+# described by its scale, in microvolts per millimetre, and the
+# distance at zero volts, offset, in millimetres.
+#
+# usage: awk -v scale=384 -v offset=0 -v full=5500 -v bits=6 -f mklut.awk
+
+BEGIN {
+	if (scale <= 0 || full <= 0 || bits < 1 || bits > 8) {
+		print "mklut.awk: bad parameters" > "/dev/stderr"
+		exit 1
+	}
+
+	n = 2 ^ bits
+	printf("/*\n")
+	printf(" * Generated by mklut.awk with scale=%d offset=%d full=%d " \
+	    "bits=%d.\n", scale, offset, full, bits)
+	printf(" * Do not edit; change the parameters in the Makefile.\n")
+	printf(" */\n\n")
+	printf("#define URS_LUT_FULL_MV\t%d\n", full)
+	printf("#define URS_LUT_SHIFT\t%d\n\n", 16 - bits)
+	printf("static const uint16_t\turs_lut[%d] PROGMEM = {", n + 1)
+
+	for (i = 0; i <= n; i++) {
+		mm = int((i * full * 1000 / n) / scale + offset + 0.5)
+		if (mm < 0) {
+			mm = 0
+		}
+		else if (mm > 65535) {
+			mm = 65535
+		}
+
+		if (i % 8 == 0) {
+			printf("\n\t")
+		}
+		else {
+			printf(" ")
+		}
+		printf("%d%s", mm, i < n ? "," : "")
+	}
+	printf("\n};\n")
+}
@@ -23,10 +23,50 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
-#include <util/setbaud.h>
+#include <avr/pgmspace.h>
 
-#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "event.h"
+#include "filter.h"
+#include "fmt.h"
+#include "serial.h"
+#include "snapshot.h"
+#include "telemetry.h"
+
+
+/*
+ * The URS can be read in one of two ways, chosen at build time with
+ * URS_BACKEND. URS_ADC reads its analog output through the ADC, and
+ * URS_PW times its pulse-width output with Timer1's input capture
+ * unit. Either way, readings end up in the same struct reading.
+ */
+#define URS_ADC		0
+#define URS_PW		1
+
+#ifndef URS_BACKEND
+#define URS_BACKEND	URS_ADC
+#endif
+
+/*
+ * Building with URS_PROFILE set adds how much of the time the CPU spends
+ * awake, interrupts included, to each report. The report is text, so it
+ * can't be used along with TELEMETRY.
+ */
+#ifndef URS_PROFILE
+#define URS_PROFILE	0
+#endif
+
+#if URS_PROFILE && TELEMETRY
+#error "URS_PROFILE reports as text, and can't be used with TELEMETRY."
+#endif
+
+
+#if URS_BACKEND == URS_ADC
+/* Generated from the sensor's scale by mklut.awk; see the Makefile. */
+#include "urs_lut.h"
 
 
 /*
@@ -40,51 +80,325 @@
 * Timer1 is set up with a prescaler of 64, which means 4 microseconds
 * per tick. The URS can range once every 49ms, which translates
 * to a timer value of 12250.
+*
+* URS_PERIOD sets the time between readings, in milliseconds; it can
+* be made longer, but no shorter.
 */
-#define URS_CYCLE	12250
+#ifndef URS_PERIOD
+#define URS_PERIOD	49
+#endif
 
+#define URS_CYCLE	((F_CPU / 64 / 1000) * URS_PERIOD)
 
-struct reading {
-/* val contains the last measurement from the ADC. */
-uint8_t		val;
+#if URS_PERIOD < 49
+#error "The URS can't range more than once every 49ms."
+#endif
+
+#if URS_CYCLE > 65535
+#error "URS_PERIOD is too long for Timer1."
+#endif
+
+
+/*
+ * URS_OVERSAMPLE trades conversions for resolution. With it set to n,
+ * each reading is the sum of 4^n 10-bit conversions taken back to back,
+ * shifted right by n, which gives 10 + n bits. The output rate is set
+ * by URS_PERIOD alone, as all of the conversions fit in one period. At
+ * 16 MHz, with the 125 kHz ADC clock and the default period:
+ *
+ *	n	bits	conversions	scan time	rate
+ *	0	8	1		0.1ms		20.4 Hz
+ *	1	11	4		0.4ms		20.4 Hz
+ *	2	12	16		1.7ms		20.4 Hz
+ *	3	13	64		6.7ms		20.4 Hz
+ *
+ * With n of zero, the ADC is read left-aligned for 8 bits as before.
+ * The extra bits are only real if the input carries at least an LSB or
+ * so of noise to dither it, which the URS's output does.
+ */
+#ifndef URS_OVERSAMPLE
+#define URS_OVERSAMPLE	0
+#endif
+
+#if URS_OVERSAMPLE > 3
+#error "URS_OVERSAMPLE can be at most 3, or the sum would overflow."
+#endif
+
+#if URS_OVERSAMPLE == 0
+#define URS_ADC_BITS	8
+#define URS_BITS	8
+#else
+#define URS_ADC_BITS	10
+#define URS_BITS	(10 + URS_OVERSAMPLE)
+#endif
+
+/*
+ * The supply is measured against the internal 1.1V bandgap reference,
+ * which is oversampled with n of 2 for a 12-bit reading. BANDGAP_MV is
+ * the bandgap's voltage; it is only within 10% of 1.1V, so it should be
+ * set from a measurement of the board's AREF pin with REFS1:0 at 11.
+ */
+#ifndef BANDGAP_MV
+#define BANDGAP_MV		1100
+#endif
+
+#define BANDGAP_MUX		0x0E
+#define BANDGAP_OVERSAMPLE	2
+#define BANDGAP_BITS		(10 + BANDGAP_OVERSAMPLE)
+
+/*
+ * A scan is, for each of the URS and the bandgap, a throwaway
+ * conversion plus 4^n real ones, at 13 ADC clocks of 128 system clocks
+ * each.
+ */
+#define SCAN_CONVERSIONS(n)	(1UL + (1UL << (2 * (n))))
+#define URS_SCAN_CLOCKS		((SCAN_CONVERSIONS(URS_OVERSAMPLE) +	\
+				  SCAN_CONVERSIONS(BANDGAP_OVERSAMPLE)) *	\
+				 13UL * 128UL)
+
+#if URS_SCAN_CLOCKS >= ((F_CPU / 1000) * URS_PERIOD)
+#error "The oversampled scan doesn't fit in URS_PERIOD."
+#endif
 
-/* count stores the number of conversions that have occurred. */
-uint16_t	count;
+
+/*
+ * The ADC sequencer converts every channel in the sequence table in
+ * turn, starting each time Timer1 triggers a scan. Each entry gives
+ * the channel's input (the MUX3:0 bits), its reference (the REFS1:0
+ * bits), its resolution in bits (8 left-aligns the result so only
+ * ADCH needs reading), and the ADC clock division factor to use for it.
+ * Slower ADC clocks give better accuracy; the datasheet asks for 50
+ * to 200 kHz for full 10-bit resolution. Finally, oversample is the n
+ * described above: 4^n conversions are summed and the sum shifted
+ * right by n.
+ */
+struct adc_channel {
+	uint8_t	mux;
+	uint8_t	ref;
+	uint8_t	bits;
+	uint8_t	prescale;
+	uint8_t	oversample;
 };
-volatile struct reading	sensor = {0, 0};
 
-#define URS_CHANNEL	ADC3D
+#define REF_AREF	0
+#define REF_AVCC	_BV(REFS0)
+#define REF_INTERNAL	(_BV(REFS1) | _BV(REFS0))
+
+#define ADC_DIV32	(_BV(ADPS2) | _BV(ADPS0))
+#define ADC_DIV64	(_BV(ADPS2) | _BV(ADPS1))
+#define ADC_DIV128	(_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))
+
+/*
+ * The slots in the table, which are also the indices of the readings.
+ * Further sensors on PC0-PC5 are added here and to the table.
+ */
+#define SLOT_URS	0
+#define SLOT_BANDGAP	1
+#define ADC_CHANNELS	2
+
+static const struct adc_channel	sequence[ADC_CHANNELS] = {
+	/* The URS, on Vcc with a 125 kHz ADC clock. */
+	{URS_CHANNEL, REF_AVCC, URS_ADC_BITS, ADC_DIV128, URS_OVERSAMPLE},
+
+	/* The bandgap, measured against Vcc to find Vcc. */
+	{BANDGAP_MUX, REF_AVCC, 10, ADC_DIV128, BANDGAP_OVERSAMPLE},
+};
+
+#define READINGS	ADC_CHANNELS
+#elif URS_BACKEND == URS_PW
+/*
+ * In pulse-width mode, the sensor's PW output goes to ICP1, which is
+ * PB0. The sensor ranges continuously, every 49ms, holding PW high
+ * for URS_PW_SCALE microseconds per inch of range; the LV-EZ's is 147.
+ * Timer1 runs freely with a prescaler of 8, so it counts half
+ * microseconds, and the pulse is timed between the two edges.
+ */
+#define ICP_DDR		DDRB
+#define ICP_PIN		PB0
+
+#ifndef URS_PW_SCALE
+#define URS_PW_SCALE	147
+#endif
+
+/*
+ * PW_MM converts microseconds to millimetres with 16 fractional bits:
+ * there are 25.4mm to an inch.
+ */
+#define PW_MM		((254UL << 16) / (10UL * URS_PW_SCALE))
+
+#define SLOT_URS	0
+#define READINGS	1
+#else
+#error "URS_BACKEND must be URS_ADC or URS_PW."
+#endif
+
+
+/*
+ * A reading holds the latest result for one channel, both as it came
+ * from the backend and after filtering, along with the number of
+ * readings that have been stored for it and the time it was stored,
+ * in milliseconds from the shared clock. For the URS, mm holds the
+ * filtered reading converted to a distance in millimetres.
+ */
+struct reading {
+	uint16_t	val;
+	uint16_t	filtered;
+	uint16_t	mm;
+	uint16_t	count;
+	uint16_t	stamp;
+};
+
+static volatile struct reading	readings[READINGS];
+static struct snapshot		readings_snap;
 
 
 /*
- * init_ADC prepares the ADC for use with the URS.
+ * Every channel's readings are run through a median and low-pass
+ * filter as they arrive; FILTER_SHIFT sets how heavily the low-pass
+ * stage smooths (see filter.h).
+ */
+#define FILTER_SHIFT	3
+
+static struct filter	filters[READINGS];
+
+
+/*
+ * to_mm converts a filtered URS reading into millimetres; each backend
+ * supplies its own.
+ */
+static uint16_t	to_mm(uint16_t val);
+
+
+/*
+ * reading_ready is run from the event loop each time a reading is
+ * stored, with the reading's slot.
+ */
+static void	reading_ready(uint8_t slot);
+
+
+/*
+ * get_reading copies out the latest reading for a slot. The readings
+ * are written by the backend's interrupt, so the copy is retried if
+ * one lands while it is being made.
  */
 static void
-init_ADC(void)
+get_reading(uint8_t slot, struct reading *reading)
 {
-	/* Use Vcc (the main power supply) as the reference. */
-	ADMUX = _BV(REFS0);
+	uint8_t	seq;
+
+	do {
+		seq = snapshot_read_begin(&readings_snap);
+		reading->val = readings[slot].val;
+		reading->filtered = readings[slot].filtered;
+		reading->mm = readings[slot].mm;
+		reading->count = readings[slot].count;
+		reading->stamp = readings[slot].stamp;
+	} while (snapshot_read_retry(&readings_snap, seq));
+}
 
-	/* Left-align the results, which gives 8-bit precision. */
-	ADMUX |= _BV(ADLAR);
 
-	/* Select the URS in the channel multiplexor.*/
-	ADMUX |= URS_CHANNEL;
+/*
+ * store_reading filters a new reading from the backend and stores it
+ * in its slot. It is only called from the backend's interrupt.
+ */
+static void
+store_reading(uint8_t slot, uint16_t val)
+{
+	uint16_t	filtered, mm = 0;
+	uint16_t	stamp = (uint16_t)millis();
 
-	/*
-	 * We really don't need a high sample rate, so we use a
-	 * high prescale. A prescale of 128 with a 16 MHz clock
-	 * means it samples at a rate of 125 kHz.
-	 */
-	ADCSRA = _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	filtered = filter_update(&filters[slot], val);
+	if (slot == SLOT_URS) {
+		mm = to_mm(filtered);
+	}
 
-	/* Enable the ADC. */
-	ADCSRA |= _BV(ADEN);
+	snapshot_write_begin(&readings_snap);
+	readings[slot].val = val;
+	readings[slot].filtered = filtered;
+	readings[slot].mm = mm;
+	readings[slot].count++;
+	readings[slot].stamp = stamp;
+	snapshot_write_end(&readings_snap);
+
+	event_post(reading_ready, slot);
+}
 
-	/* Disable digital inputs on the URS channel. */
-	DIDR0 |= _BV(URS_CHANNEL);
 
-	/* Kick off the first conversion. */
+#if URS_BACKEND == URS_ADC
+/*
+ * The sequencer's state: the slot being converted, and whether the
+ * conversion in progress is a throwaway one. The first conversion after
+ * the multiplexor or reference changes may not have settled, so it is
+ * always discarded. seq_sum and seq_taken accumulate an oversampled
+ * reading.
+ */
+static volatile uint8_t		seq_slot = 0;
+static volatile bool		seq_discard = false;
+static volatile uint16_t	seq_sum = 0;
+static volatile uint8_t		seq_taken = 0;
+
+
+/*
+ * select_channel sets the ADC up for the channel in slot, returning
+ * true if ADMUX changed.
+ */
+static bool
+select_channel(uint8_t slot)
+{
+	const struct adc_channel	*ch = &sequence[slot];
+	uint8_t				 admux;
+
+	admux = ch->ref | (ch->mux & 0x0F);
+	if (ch->bits == 8) {
+		admux |= _BV(ADLAR);
+	}
+
+	ADCSRA = (ADCSRA & ~(_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0) |
+	    _BV(ADIF))) | ch->prescale;
+	if (ADMUX == admux) {
+		return false;
+	}
+
+	ADMUX = admux;
+	return true;
+}
+
+
+/*
+ * init_ADC prepares the ADC for use with the sequencer. Each scan is
+ * started by the hardware, using Timer1's compare B match as the
+ * auto-trigger source, so scans happen at exactly the URS cadence and
+ * only the completion interrupt ever runs.
+ */
+static void
+init_ADC(void)
+{
+	uint8_t	i;
+
+	/* Start a conversion on each Timer1 compare B match. */
+	ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+
+	/*
+	 * Enable the ADC, with auto-triggering and the conversion
+	 * complete interrupt.
+	 */
+	ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE);
+
+	/* Disable digital inputs on the analog pins being used. */
+	for (i = 0; i < ADC_CHANNELS; i++) {
+		if (sequence[i].mux < 6) {
+			DIDR0 |= _BV(sequence[i].mux);
+		}
+		filter_init(&filters[i], FILTER_SHIFT);
+	}
+
+	/*
+	 * Set up for the first channel. Its throwaway conversion is
+	 * run straight away, so that the first scan starts settled.
+	 */
+	seq_slot = 0;
+	select_channel(0);
+	seq_discard = true;
 	ADCSRA |= _BV(ADSC);
 }
 
@@ -98,129 +412,403 @@ init_timer1(void)
 	 */
 	TCCR1B |= _BV(WGM12);
 
+	/* Set the output compare register to the update interval. */
+	OCR1A = URS_CYCLE;
+
+	/*
+	 * Compare B matches once per cycle, at the top, and that match
+	 * is what triggers the ADC. No timer interrupt is enabled.
+	 */
+	OCR1B = URS_CYCLE;
+
 	/* Use a prescaler of 64. */
 	TCCR1B |= _BV(CS11) | _BV(CS10);
+}
 
-	/* Trigger an interrupt on output compare A. */
-	TIMSK1 |= _BV(OCIE1A);
 
-	/* Set the output compare register to the update interval. */
-	OCR1A = URS_CYCLE;
+/*
+ * The distance conversion works on the URS input voltage as a 16-bit
+ * fraction of URS_LUT_FULL_MV, the top of the lookup table. A reading
+ * is a fraction of Vcc, so it is first scaled by ref_scale, which is
+ * Vcc / URS_LUT_FULL_MV with 15 fractional bits.
+ *
+ * With URS_RATIOMETRIC set, the sensor's output is taken to follow Vcc
+ * just as the ADC's reference does, as the LV-EZ's does, so a reading
+ * means the same distance whatever the supply; the table is laid out
+ * for VCC_NOMINAL_MV, and ref_scale is fixed there. Otherwise, the
+ * sensor's output is taken to be absolute, and ref_scale is worked out
+ * by update_reference from the bandgap reading and handed to the
+ * interrupt through a pair of buffers; until then, Vcc is taken to be
+ * VCC_NOMINAL_MV.
+ */
+#ifndef URS_RATIOMETRIC
+#define URS_RATIOMETRIC	1
+#endif
+
+#define VCC_NOMINAL_MV	5000
+#define REF_SCALE(mv)	((uint16_t)(((uint32_t)(mv) << 15) / URS_LUT_FULL_MV))
+
+#if VCC_NOMINAL_MV > URS_LUT_FULL_MV
+#error "The lookup table must reach at least the nominal supply voltage."
+#endif
+
+#if !URS_RATIOMETRIC
+static uint16_t		ref_scale[2] = {
+	REF_SCALE(VCC_NOMINAL_MV), REF_SCALE(VCC_NOMINAL_MV)
+};
+static struct publish	ref_pub;
+#endif
+
+
+/*
+ * The ADC backend's to_mm converts a URS reading into millimetres, by
+ * looking up the two table entries on either side of it and
+ * interpolating between them. It costs two multiplies and two flash
+ * reads, with no division.
+ */
+static uint16_t
+to_mm(uint16_t code)
+{
+	uint32_t	v;
+	uint16_t	a, b, frac;
+	uint8_t		i;
+
+#if URS_RATIOMETRIC
+	v = ((uint32_t)code << (16 - URS_BITS)) * REF_SCALE(VCC_NOMINAL_MV);
+#else
+	v = ((uint32_t)code << (16 - URS_BITS)) *
+	    ref_scale[snapshot_take(&ref_pub)];
+#endif
+	v >>= 15;
+	if (v > 0xFFFF) {
+		v = 0xFFFF;
+	}
+
+	i = (uint8_t)(v >> URS_LUT_SHIFT);
+	frac = (uint16_t)v & ((1 << URS_LUT_SHIFT) - 1);
+	a = pgm_read_word(&urs_lut[i]);
+	b = pgm_read_word(&urs_lut[i + 1]);
+
+	return a + (uint16_t)(((uint32_t)(b - a) * frac) >> URS_LUT_SHIFT);
 }
 
 
 /*
- * The Timer1 ISR triggers an ADC conversion every URS_CYCLE ticks.
+ * update_reference works out Vcc from a filtered bandgap reading,
+ * returning it in millivolts, and, for a sensor that isn't ratiometric,
+ * updates ref_scale to match. The divisions are done here rather than
+ * in the ADC interrupt. A supply above the top of the table can't be
+ * right, and is left out of the correction.
  */
-ISR(TIMER1_COMPA_vect)
+static uint16_t
+update_reference(uint16_t bandgap)
 {
-	/* Clear pending ADC interrupts. */
-	ADCSRA |= _BV(ADIF);
+	uint32_t	vcc;
+#if !URS_RATIOMETRIC
+	uint8_t		spare;
+#endif
 
-	/* Select the URS channel. */
-	ADMUX = (ADMUX & 0xF8) | URS_CHANNEL;
+	if (bandgap == 0) {
+		return 0;
+	}
 
-	/* Trigger an ADC conversion. */
-	ADCSRA |= _BV(ADSC);
+	vcc = ((uint32_t)BANDGAP_MV << BANDGAP_BITS) / bandgap;
+	if (vcc > URS_LUT_FULL_MV) {
+		return (uint16_t)(vcc > 0xFFFF ? 0xFFFF : vcc);
+	}
+
+#if !URS_RATIOMETRIC
+	spare = snapshot_publish_begin(&ref_pub);
+	ref_scale[spare] = REF_SCALE(vcc);
+	snapshot_publish_end(&ref_pub);
+#endif
 
-	/* Enable the ADC interrupt. */
-	ADCSRA |= _BV(ADIE);
+	return (uint16_t)vcc;
 }
 
 
+/*
+ * The ADC ISR runs the sequencer. Each conversion's result is added to
+ * its channel's sum (unless it is a throwaway), and once enough have
+ * been taken, the decimated reading is stored in the channel's slot.
+ * The next conversion in the scan is started by hand. Once the scan
+ * wraps back around to the first channel, it waits for Timer1 to
+ * trigger the next one.
+ */
 ISR(ADC_vect)
 {
-	/*
-	 * Read the distance measurement into the sensor readout
-	 * structure.
-	 */
-	sensor.val = ADCH;
-	sensor.count++;
+	const struct adc_channel	*ch;
+	uint8_t				 slot = seq_slot;
+
+	if (seq_discard) {
+		seq_discard = false;
+	}
+	else {
+		ch = &sequence[slot];
+		if (ch->bits == 8) {
+			seq_sum += ADCH;
+		}
+		else {
+			seq_sum += ADC;
+		}
+
+		seq_taken++;
+		if (seq_taken < (uint8_t)(1 << (2 * ch->oversample))) {
+			ADCSRA |= _BV(ADSC);
+			return;
+		}
+
+		store_reading(slot, seq_sum >> ch->oversample);
+		seq_sum = 0;
+		seq_taken = 0;
+
+		slot++;
+		if (slot == ADC_CHANNELS) {
+			slot = 0;
+		}
+		seq_slot = slot;
+		seq_discard = select_channel(slot);
+	}
+
+	if (slot != 0 || seq_discard) {
+		ADCSRA |= _BV(ADSC);
+		return;
+	}
 
 	/*
-	 * Turn off the ADC interrupt and clear any pending
-	 * interrupts.
+	 * The ADC only starts a conversion on a rising edge of the
+	 * trigger flag. Nothing else clears OCF1B, so it is cleared
+	 * here, ready for the next match.
 	 */
-	ADCSRA |= _BV(ADIF);
-	ADCSRA &= ~_BV(ADIE);
+	TIFR1 = _BV(OCF1B);
 }
 
 
+#elif URS_BACKEND == URS_PW
 /*
- * init_UART brings up the serial port.
+ * The pulse is timed from Timer1's input capture unit, which copies
+ * TCNT1 into ICR1 on the selected edge of ICP1. The counter is extended
+ * by counting overflows, as the longest pulse is longer than Timer1's
+ * 32.8ms period. rose_at is when the current pulse started.
  */
+static volatile uint8_t		overflows = 0;
+static volatile uint32_t	rose_at = 0;
+
+
 static void
-init_UART(void)
+init_timer1(void)
 {
-	/*
-	 * The UBRR register is a UART baud rate register. We're using
-	 * UART 0. It's a 16-bit register, and we need to set the high
-	 * and low bytes to the values automatically provided for us by
-	 * the util/setbaud.h header.
-	 */
-	UBRR0H = UBRRH_VALUE;
-	UBRR0L = UBRRL_VALUE;
+	filter_init(&filters[SLOT_URS], FILTER_SHIFT);
+	ICP_DDR &= ~_BV(ICP_PIN);
 
 	/*
-	 * UART control status registers (or UCSR0 for UART 0) control
-	 * the UART's operation. There are three such registers, labeled
-	 * A, B, and C.
+	 * Normal mode, with a prescaler of 8. The noise canceller is
+	 * turned on, and the first capture is on a rising edge.
 	 */
+	TCCR1A = 0;
+	TCCR1B = _BV(ICNC1) | _BV(ICES1) | _BV(CS11);
 
-	/*
-	 * In UCSR0A, we want to disable 2x transmission speed.
-	 */
-	UCSR0A &= ~(1 << U2X0);
+	TIFR1 = _BV(ICF1) | _BV(TOV1);
+	TIMSK1 = _BV(ICIE1) | _BV(TOIE1);
+}
 
-	/*
-	 * Enable the transmitter (transmit enable 0) and receiver
-	 * (receive enable 0).
-	 */
-	UCSR0B = ((1 << TXEN0)|(1 << RXEN0));
 
-	/*
-	 * Now, we set the framing to the most common format: 8 data bits,
-	 * one stop bit.
-	 */
-	UCSR0C = ((1 << UCSZ01)|(1 << UCSZ00));
+/*
+ * The pulse-width backend's to_mm scales microseconds to millimetres.
+ */
+static uint16_t
+to_mm(uint16_t us)
+{
+	return (uint16_t)(((uint32_t)us * PW_MM) >> 16);
+}
+
+
+ISR(TIMER1_OVF_vect)
+{
+	overflows++;
 }
 
 
 /*
- * write_string writes the string to the serial port.
+ * The capture ISR timestamps each edge of the pulse, alternating
+ * between rising and falling edges, and stores the width in
+ * microseconds when the pulse ends. If Timer1 overflowed just before
+ * the capture, the overflow interrupt won't have run yet, so it is
+ * counted here instead.
+ */
+ISR(TIMER1_CAPT_vect)
+{
+	uint16_t	icr = ICR1;
+	uint8_t		ovf = overflows;
+	uint32_t	now, width;
+
+	if ((TIFR1 & _BV(TOV1)) && icr < 0x8000) {
+		ovf++;
+	}
+	now = ((uint32_t)ovf << 16) | icr;
+
+	if (TCCR1B & _BV(ICES1)) {
+		rose_at = now;
+		TCCR1B &= ~_BV(ICES1);
+	}
+	else {
+		TCCR1B |= _BV(ICES1);
+		width = ((now - rose_at) & 0xFFFFFFUL) >> 1;
+		store_reading(SLOT_URS, width > 0xFFFF ? 0xFFFF : width);
+	}
+
+	/* Changing the edge can set ICF1, so it is cleared afterwards. */
+	TIFR1 = _BV(ICF1);
+}
+#endif
+
+
+#if TELEMETRY
+/*
+ * send_reading streams a reading to the host as a telemetry frame.
  */
 static void
-write_string(char *s)
+send_reading(const struct reading *reading, uint16_t vcc)
 {
-	int	i = 0;
+	uint8_t	payload[TELEMETRY_URS_SIZE];
+
+	payload[0] = (uint8_t)reading->count;
+	payload[1] = (uint8_t)(reading->count >> 8);
+	payload[2] = (uint8_t)reading->val;
+	payload[3] = (uint8_t)(reading->val >> 8);
+	payload[4] = (uint8_t)reading->filtered;
+	payload[5] = (uint8_t)(reading->filtered >> 8);
+	payload[6] = (uint8_t)reading->mm;
+	payload[7] = (uint8_t)(reading->mm >> 8);
+	payload[8] = (uint8_t)vcc;
+	payload[9] = (uint8_t)(vcc >> 8);
+
+	telemetry_send(TELEMETRY_URS, reading->stamp, payload,
+	    sizeof(payload));
+}
+#endif
+
 
-	while (s[i] != 0) {
-		loop_until_bit_is_set(UCSR0A, UDRE0);
-		UDR0 = s[i];
-		i++;
+/*
+ * The main program's state: the supply voltage worked out from the
+ * latest bandgap reading (zero if it isn't measured) and, in text
+ * mode, when the next report is due.
+ */
+static uint16_t	vcc = 0;
+#if !TELEMETRY
+static uint32_t	due;
+#endif
+
+
+#if TELEMETRY
+/*
+ * In telemetry mode, every reading is sent as soon as it is taken. The
+ * pulse-width backend doesn't measure the supply, so it is sent as
+ * zero.
+ */
+static void
+reading_ready(uint8_t slot)
+{
+	struct reading	reading;
+
+	get_reading(slot, &reading);
+#if URS_BACKEND == URS_ADC
+	if (slot == SLOT_BANDGAP) {
+		vcc = update_reference(reading.filtered);
+		return;
+	}
+#endif
+
+	send_reading(&reading, vcc);
+}
+#else
+/*
+ * In text mode, a report is due once a second, and is made with the
+ * first URS reading after that. The next one is timed from when the
+ * last was due rather than when it was made, so the reports don't
+ * drift.
+ */
+static void
+reading_ready(uint8_t slot)
+{
+	struct reading	urs;
+#if URS_BACKEND == URS_ADC
+	struct reading	bandgap;
+#endif
+
+	if (slot != SLOT_URS || (int32_t)(millis() - due) < 0) {
+		return;
+	}
+	due += 1000;
+
+#if URS_BACKEND == URS_ADC
+	get_reading(SLOT_BANDGAP, &bandgap);
+	vcc = update_reference(bandgap.filtered);
+#endif
+
+	get_reading(SLOT_URS, &urs);
+	write_string_P(PSTR("URS reading #"));
+	write_uint(urs.count, 5);
+	write_string_P(PSTR(": "));
+	write_uint(urs.val, 0);
+	write_string_P(PSTR(" (filtered "));
+	write_uint(urs.filtered, 0);
+	write_string_P(PSTR("), "));
+	write_uint(urs.mm, 0);
+	write_string_P(PSTR("mm"));
+	if (vcc != 0) {
+		write_string_P(PSTR(", Vcc "));
+		write_fixed(vcc, 0, 3);
+		serial_write('V');
 	}
+#if URS_PROFILE
+	write_string_P(PSTR(", awake "));
+	write_fixed(event_awake(), 0, 1);
+	serial_write('%');
+#endif
+	newline();
 }
+#endif
 
 
 int
 main(void)
 {
-	char	buf[32];
-
+	clock_init();
+#if URS_BACKEND == URS_ADC
 	init_ADC();
+#endif
 	init_timer1();
 	init_UART();
 	sei();
 
+	/*
+	 * In telemetry mode, the boot message is left out, as it would
+	 * only be noise to the host's decoder.
+	 */
+#if !TELEMETRY
 	write_string("Boot OK.\r\n");
+#if URS_BACKEND == URS_ADC
+	write_string_P(PSTR("URS: "));
+	write_uint(URS_BITS, 0);
+	write_string_P(PSTR(" bits every "));
+	write_uint(URS_PERIOD, 0);
+	write_string_P(PSTR("ms"));
+#else
+	write_string_P(PSTR("URS: pulse width, "));
+	write_uint(URS_PW_SCALE, 0);
+	write_string_P(PSTR("us/in"));
+#endif
+	newline();
+
+	due = millis() + 1000;
+#endif
 
-	while (1) {
-		_delay_ms(1001);
-		snprintf(buf, 31, "URS reading #%5u: %u\r\n",
-		    sensor.count, sensor.val);
-		write_string(buf);
-	}
+	/*
+	 * Everything from here on is run as readings come in; the main
+	 * program sleeps between them.
+	 */
+	event_loop();
 
 	return 0;
 }
-
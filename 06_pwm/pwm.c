@@ -20,44 +20,68 @@
 * OTHER DEALINGS IN THE SOFTWARE.
 */
 
-
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
-#include <util/setbaud.h>
+#include <avr/pgmspace.h>
 
-#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-#warning "The PWM code is still under development."
+#include "fmt.h"
+#include "serial.h"
+#include "snapshot.h"
+#include "telemetry.h"
 
-// The PWM subsystem uses Timer1.
-static void
-initTimer1(void)
-{
-	// Disable powersaving mode on Timer1 to enable it.
-	PRR0 &= ~_BV(PRTIM1);
 
-	TCCR1A = 0;
-	TCCR1B = _BV(CS11);	// Set prescaler to 8.
+// Building with SERVO_PROFILE set adds timing measurements to the servo
+// ISR, which are reported over the serial port once a second.
+#ifndef SERVO_PROFILE
+#define SERVO_PROFILE	0
+#endif
 
-	// Now, Timer1 must be prepared for use.
-	TCNT1 = 0;		// Reset the timer counter.
-	TIFR1 |= _BV(OCF1A);	// Drop any existing interrupts on the timer.
-	TIMSK1 |= _BV(OCIE1A);	// Enable Timer1's output compare interrupt.
-}
+// Building with SERVO_HW_OUTPUTS set drives the first two servos straight
+// from Timer1's compare outputs, OC1A (PB1) and OC1B (PB2), and moves the
+// rest onto Timer2. See initTimer1 for the details.
+#ifndef SERVO_HW_OUTPUTS
+#define SERVO_HW_OUTPUTS	0
+#endif
 
-// The PWM code takes the same approach as the Arduino code: OC1A is
-// used as a tick counter and pins are manually strobed. The previous
-// approach of using OC1A and OC1B was leading to the motors having
-// different speeds.
 
-// All servos are attached to port B. See the hardware documentation for
-// more details.
+// The servos are driven in groups. Every servo in a group has its pulse
+// started at the same moment, with a single write to the group's port,
+// and then each pulse is ended in turn, shortest first. Time is divided
+// into 2.5ms slots, each long enough for the longest pulse, and the groups
+// take turns in them, so the frame length doesn't depend on how many
+// servos there are or how long their pulses are.
+//
+// Each group repeats its pulses every so many slots: every eight, or 20ms,
+// for analog servos, and more often for digital servos that can take a
+// faster refresh. Groups in use can't share a slot, so how often depends
+// on the others: every slot for a group on its own, every other slot for
+// port B alongside either of the others, or for D or C alongside B alone,
+// and every fourth for D and C together. A frame is as long as the slowest
+// group in use, so with only digital servos connected the frame is short,
+// and new settings take effect that much sooner.
+//
+// Every pin change is a toggle made by writing the pin's bit to the PINx
+// register, so each change is one store with no read-modify-write, and
+// the ISR does nothing else to the ports.
+//
+// The main program works out the whole frame ahead of time as a table of
+// compare events sorted by time, and hands it to the ISR through a pair of
+// buffers; the ISR only switches tables between frames, so a frame is
+// always run from one consistent table.
+//
+// With hardware outputs, the first two servos aren't part of any group;
+// the timer itself makes their edges, so no interrupt can move them. The
+// remaining servos are grouped and scheduled as above, on Timer2.
 
 
 #define DUTY_CYCLE	20000	// Servo duty cycle is 20ms.
-#define UPDATE_INTERVAL	40000
-#define UPDATE_WAIT	5	// Allow some delay for updates.
+#define FRAME_TICKS	(DUTY_CYCLE * 2)
+#define GROUP_SLOT	2500	// Each group gets 2.5ms slots.
+#define GROUP_TICKS	(GROUP_SLOT * 2)
+#define FRAME_SLOTS	(DUTY_CYCLE / GROUP_SLOT)
 
 // The following pulse ranges are specified in the servo datasheet.
 
@@ -68,41 +92,502 @@ initTimer1(void)
 #define MID_PULSE	1500	// 1.5ms stop pulse.
 #define MAX_PULSE	1700	// 1.7ms for full forward rotation.
 
+// No servo's limits can be set outside of these.
+#define PULSE_FLOOR	500
+#define PULSE_CEILING	2400
+
+// Servos moved with move_servo or move_servos follow a motion profile,
+// stepped every 20ms, that is limited to these by default: a full sweep
+// of a drivetrain servo's range takes a little under a second.
+#define FRAME_RATE	(1000000UL / DUTY_CYCLE)
+#define MOTION_VMAX	1000	// Microseconds of pulse width per second.
+#define MOTION_ACCEL	2000	// Microseconds per second per second.
+
+// Two pin changes closer together than EVENT_MIN_GAP ticks are made by the
+// same event, at the time of the first. The ISR needs a few microseconds
+// to get to the next event, and a compare match set for a time that has
+// already passed wouldn't come around again until the timer wraps.
+#define EVENT_MIN_GAP	16
+
+// The gap alone can't be relied on: another interrupt running first can
+// hold the servo ISR off for longer than that. So once the ISR has set
+// the next compare match, it checks that the match is at least EVENT_LEAD
+// ticks ahead of the count, and if it isn't, makes the next event then
+// and there instead of waiting for a match that may already be gone. The
+// edge is late, but by the latency rather than by a whole turn of the
+// timer.
+#define EVENT_LEAD	2
+
+
+// A servo_group is a port that servos are connected to, given by its PINx
+// and DDRx registers, the pins on it that are free for servos, and the
+// slot it has first claim to. No group has more than GROUP_PINS pins.
+struct servo_group {
+	volatile uint8_t	*pin;
+	volatile uint8_t	*ddr;
+	uint8_t			 pins;
+	uint8_t			 slot;
+};
+
+#define GROUPS		3
+#define GROUP_PINS	6
+#define NO_GROUP	0xFF
+
+// With hardware outputs, PB1 and PB2 belong to OC1A and OC1B.
+#if SERVO_HW_OUTPUTS
+#define GROUP_B_PINS	0x39
+#else
+#define GROUP_B_PINS	0x3F
+#endif
+
+static const struct servo_group	groups[GROUPS] = {
+	{&PINB, &DDRB, GROUP_B_PINS, 0},	// PB6 and PB7 carry the crystal.
+	{&PIND, &DDRD, 0xFC, 1},		// PD0 and PD1 are the serial port.
+	{&PINC, &DDRC, 0x3F, 3},		// PC0-PC5.
+};
+
+// The frame is closed CLOSE_LEAD ticks before it ends, in the quiet time
+// at the end of its last slot.
+#define CLOSE_LEAD	(EVENT_MIN_GAP * 2)
+
+#if (DUTY_CYCLE % GROUP_SLOT) != 0 || (FRAME_SLOTS & (FRAME_SLOTS - 1)) != 0
+#error "The frame must be a power-of-two number of slots."
+#endif
+
+#if (PULSE_CEILING * 2 + EVENT_MIN_GAP + CLOSE_LEAD) > GROUP_TICKS
+#error "The longest pulse doesn't fit in a group's slot."
+#endif
+
+
+// A group's period is the number of slots between the starts of its
+// pulses, and is a power of two no larger than FRAME_SLOTS, so that it
+// divides the frame evenly. The group uses the slots that leave the same
+// remainder as its own slot when divided by the period, so two groups
+// want the same slot exactly when their own slots leave the same
+// remainder when divided by the shorter of the two periods. A group with
+// no servos takes no slots, so only groups in use can clash. PERIOD_B,
+// PERIOD_D and PERIOD_C give the periods the groups start with.
+#ifndef PERIOD_B
+#define PERIOD_B	FRAME_SLOTS
+#endif
+#ifndef PERIOD_D
+#define PERIOD_D	FRAME_SLOTS
+#endif
+#ifndef PERIOD_C
+#define PERIOD_C	FRAME_SLOTS
+#endif
+
+#define PERIOD_VALID(p)		((p) > 0 && (p) <= FRAME_SLOTS &&	\
+				 ((p) & ((p) - 1)) == 0)
+#define PERIOD_MIN(p, q)	((p) < (q) ? (p) : (q))
+#define SLOTS_CLASH(a, p, b, q)	(((a) % PERIOD_MIN(p, q)) ==		\
+				 ((b) % PERIOD_MIN(p, q)))
+
+#if !PERIOD_VALID(PERIOD_B) || !PERIOD_VALID(PERIOD_D) || \
+    !PERIOD_VALID(PERIOD_C)
+#error "Group periods must be a power of two no larger than FRAME_SLOTS."
+#endif
+
+// The servos main connects are on ports B and D, so those two must not
+// clash. Port C is checked when a servo is connected to it.
+#if SLOTS_CLASH(0, PERIOD_B, 1, PERIOD_D)
+#error "PERIOD_B and PERIOD_D don't leave each group slots of its own."
+#endif
 
-// A servo collects relevant information about a collected servo. All
-// servos are connected to port B, so the pin is relative to PORTB.
+static uint8_t	periods[GROUPS] = {PERIOD_B, PERIOD_D, PERIOD_C};
+
+
+// A servo collects relevant information about a connected servo. The pin
+// is relative to the group's port; a servo on a compare output has no
+// group.
 struct servo {
+	uint8_t		group;
 	uint8_t		pin;
-	uint32_t	tcnt;	// Tick counter
+	uint16_t	tcnt;	// Tick counter
 	uint16_t	min;
 	uint16_t	max;
 	int16_t		trim;	// Adjust for variances in an individual servo.
+
+	// Motion profile settings and the current move; see move_servos.
+	uint16_t	vmax;	// Microseconds of pulse width per second.
+	uint16_t	accel;	// Microseconds per second per second.
+	uint8_t		motion;
+	uint16_t	start;
+	int16_t		delta;
 };
 
 
-// The servos variable stores all the servos connected to the board.
-#define ACTIVE_SERVOS	2
-static struct servo	servos[ACTIVE_SERVOS] = {
-	{0, MID_PULSE, 0, 0, 0},
-	{0, MID_PULSE, 0, 0, 0}
+// The servos variable stores all the servos connected to the board. It
+// belongs to the main program; the ISR only ever sees the event tables
+// built from it.
+#define ACTIVE_SERVOS	12
+static struct servo	servos[ACTIVE_SERVOS];
+
+// HW_SERVOS is the number of servos, counted from the first, that are
+// driven by compare outputs rather than by the event tables.
+#if SERVO_HW_OUTPUTS
+#define HW_SERVOS	2
+#else
+#define HW_SERVOS	0
+#endif
+
+
+// A frame is a table of compare events. At each event's compare value,
+// counted from the start of the frame, its mask is written to its
+// group's PINx register, toggling those pins. Each slot used by a group
+// has a start event and at most one end event per servo in the group,
+// and the frame ends with a closing event, CLOSE_LEAD ticks before the
+// frame is over, that changes nothing; that is where the ISR switches
+// tables. ticks is the length of the frame, and slots the number of slots
+// in it.
+//
+// The table is kept as parallel arrays of 16-bit compare values, port
+// pointers and masks, so the ISR only has to add the compare value to the
+// frame's start time.
+#define MAX_EVENTS	(FRAME_SLOTS * (GROUP_PINS + 1) + 1)
+
+struct servo_table {
+	uint16_t		 ocr[MAX_EVENTS];
+	volatile uint8_t	*pin[MAX_EVENTS];
+	uint8_t			 mask[MAX_EVENTS];
+	uint8_t			 count;
+	uint8_t			 slots;
+	uint16_t		 ticks;
+	uint16_t		 seq;
+};
+
+static struct servo_table	tables[2];
+static struct publish		table_pub;
+
+// Each table published is numbered from table_seq, so that a later table
+// can be told from an earlier one.
+static uint16_t			table_seq = 0;
+
+// The ISR's state: the table for the current frame, and the next event in
+// it. frame_count is advanced each time the ISR moves on to a new frame,
+// and slot_count by the number of slots in the frame just finished.
+static struct servo_table	*table = &tables[0];
+static volatile uint8_t		next_event = 0;
+static volatile uint16_t	frame_count = 0;
+static volatile uint8_t		slot_count = 0;
+
+// While ack_waiting is set, the ISR watches for the first table numbered
+// ack_table or later to go live, records the frame it was first used on in
+// ack_frame, and clears ack_waiting. The main program only changes
+// ack_table while ack_waiting is clear.
+static volatile bool		ack_waiting = false;
+static volatile uint16_t	ack_table;
+static volatile uint16_t	ack_frame;
+
+
+// group_used returns true if any servo is connected to the group.
+static bool
+group_used(uint8_t group)
+{
+	uint8_t	i;
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		if (servos[i].group == group) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+// period_clashes returns true if the group, with the given period, would
+// want a slot that another group in use needs.
+static bool
+period_clashes(uint8_t group, uint8_t period)
+{
+	uint8_t	g;
+
+	for (g = 0; g < GROUPS; g++) {
+		if (g != group && group_used(g) &&
+		    SLOTS_CLASH(groups[group].slot, period, groups[g].slot,
+		    periods[g])) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+// add_event appends an event to a table under construction, folding it
+// into the previous event if they are on the same port and too close
+// together to be made separately.
+static void
+add_event(struct servo_table *t, uint16_t at, volatile uint8_t *pin,
+    uint8_t mask)
+{
+	uint8_t	last = t->count - 1;
+
+	if (t->count > 0 && t->pin[last] == pin &&
+	    (at - t->ocr[last]) < EVENT_MIN_GAP) {
+		t->mask[last] |= mask;
+		return;
+	}
+
+	t->ocr[t->count] = at;
+	t->pin[t->count] = pin;
+	t->mask[t->count] = mask;
+	t->count++;
+}
+
+
+// publish_servos builds the event table for the current servo settings
+// and hands it to the ISR, which will start using it at the next frame.
+static void
+publish_servos(void)
+{
+	struct servo_table	*t;
+	struct servo		*s;
+	uint8_t			 order[GROUPS][GROUP_PINS];
+	uint8_t			 count[GROUPS], mask[GROUPS];
+	uint8_t			 g, i, j, n, slot;
+	uint16_t		 base;
+
+	t = &tables[snapshot_publish_begin(&table_pub)];
+	t->count = 0;
+	t->slots = 1;
+	t->seq = ++table_seq;
+
+	// Collect each group's servos, sorted by pulse width, and make the
+	// frame as long as the longest period of the groups in use.
+	for (g = 0; g < GROUPS; g++) {
+		n = 0;
+		mask[g] = 0;
+		for (i = 0; i < ACTIVE_SERVOS; i++) {
+			if (servos[i].group != g) {
+				continue;
+			}
+
+			mask[g] |= _BV(servos[i].pin);
+			for (j = n; j > 0 &&
+			    servos[order[g][j - 1]].tcnt > servos[i].tcnt; j--) {
+				order[g][j] = order[g][j - 1];
+			}
+			order[g][j] = i;
+			n++;
+		}
+
+		count[g] = n;
+		if (n > 0 && periods[g] > t->slots) {
+			t->slots = periods[g];
+		}
+	}
+
+	for (slot = 0; slot < t->slots; slot++) {
+		for (g = 0; g < GROUPS; g++) {
+			if (count[g] > 0 && (slot % periods[g]) ==
+			    (groups[g].slot % periods[g])) {
+				break;
+			}
+		}
+
+		if (g == GROUPS) {
+			continue;
+		}
+
+		// Start every pulse in the group, then end them in order.
+		base = slot * GROUP_TICKS;
+		add_event(t, base, groups[g].pin, mask[g]);
+		for (i = 0; i < count[g]; i++) {
+			s = &servos[order[g][i]];
+			add_event(t, base + s->tcnt, groups[g].pin,
+			    _BV(s->pin));
+		}
+	}
+
+	// Every frame ends with the closing event; writing zero toggles
+	// nothing.
+	t->ticks = t->slots * GROUP_TICKS;
+	add_event(t, t->ticks - CLOSE_LEAD, groups[0].pin, 0);
+
+	snapshot_publish_end(&table_pub);
+}
+
+
+// set_group_period changes how many slots apart a group's pulses are,
+// returning false if the period isn't allowed or would take a slot that
+// another group in use needs. The change takes effect at the start of a
+// frame.
+bool
+set_group_period(uint8_t group, uint8_t period)
+{
+	if (group >= GROUPS || !PERIOD_VALID(period) ||
+	    period_clashes(group, period)) {
+		return false;
+	}
+
+	periods[group] = period;
+	publish_servos();
+	return true;
+}
+
+
+// A motion moves one or more servos together from where they are to new
+// pulse widths. Rather than each servo following its own profile, the
+// motion steps a single trapezoidal profile for its progress, s, from 0 to
+// MOTION_ONE, and every servo in it is placed in proportion: at start +
+// delta * s / MOTION_ONE. Every servo in a motion therefore starts and
+// finishes on the same frame, and the whole move is as fast as the
+// slowest of them allows.
+//
+// The progress, its velocity and its acceleration are all fixed point,
+// in MOTION_ONE units per frame, with enough fractional bits that a full
+// range move still advances by many steps per tick of pulse width.
+#define MOTION_ONE	(1UL << 20)
+#define NO_MOTION	0xFF
+
+#define MOTION_ACCEL_PHASE	0
+#define MOTION_CRUISE		1
+#define MOTION_DECEL		2
+
+struct motion {
+	uint32_t	s;
+	uint32_t	v;
+	uint32_t	vmax;
+	uint32_t	accel;
+	uint32_t	ramp;	// Progress made while speeding up.
+	uint16_t	servos;	// The servos in the motion, one bit each.
+	uint8_t		phase;
 };
-static volatile int8_t	active = 0;
+
+// No servo is ever in more than one motion, so there can't be more
+// motions than servos.
+static struct motion	motions[ACTIVE_SERVOS];
+static uint8_t		motion_slot;
+
+
+// stop_motion takes a servo out of its motion, if it is in one, leaving
+// it where it is. The other servos in the motion carry on.
+static void
+stop_motion(uint8_t which)
+{
+	uint8_t	m = servos[which].motion;
+
+	if (m != NO_MOTION) {
+		motions[m].servos &= ~_BV(which);
+		servos[which].motion = NO_MOTION;
+	}
+}
+
+
+#if SERVO_HW_OUTPUTS
+// set_compare loads a hardware servo's pulse width into its compare
+// register. In fast PWM mode, the output is set at BOTTOM and cleared on
+// the tick after the compare match, so a compare value of n gives a pulse
+// of n + 1 ticks; loading the tick count itself, as the old OC1A/OC1B
+// code did, made these pulses half a microsecond longer than the rest and
+// left the motors on them running at a different speed. Taking one off
+// makes the pulse exactly tcnt ticks long, the same as a software servo
+// given the same setting.
+//
+// No ISR touches Timer1's 16-bit registers in this build, so the shared
+// TEMP register needs no protection here. The compare registers are
+// double buffered and only take the new value at BOTTOM, so a change never
+// cuts a pulse short or stretches it.
+static void
+set_compare(uint8_t which)
+{
+	if (which == 0) {
+		OCR1A = servos[which].tcnt - 1;
+	}
+	else {
+		OCR1B = servos[which].tcnt - 1;
+	}
+}
+#endif
+
+
+// update_servo hands a servo's new settings to whichever mechanism drives
+// it.
+static void
+update_servo(uint8_t which)
+{
+#if SERVO_HW_OUTPUTS
+	if (which < HW_SERVOS) {
+		set_compare(which);
+		return;
+	}
+#endif
+
+	publish_servos();
+}
 
 
+// pin_free returns true if a servo can be connected to the pin: it must
+// be one of the group's pins, and no other servo may be using it. A servo
+// can't be the first in its group if the group's period would clash with
+// a group already in use.
+static bool
+pin_free(uint8_t which, uint8_t group, uint8_t pin)
+{
+	uint8_t	i;
+
+	if (group >= GROUPS || pin > 7 || !(groups[group].pins & _BV(pin))) {
+		return false;
+	}
+
+	if (!group_used(group) && period_clashes(group, periods[group])) {
+		return false;
+	}
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		if (i != which && servos[i].group == group &&
+		    servos[i].pin == pin) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// connect attaches a servo to a pin in one of the groups. The servos on
+// compare outputs can only be on those pins, so group and pin are ignored
+// for them.
 void
-connect(uint8_t which, uint8_t pin)
+connect(uint8_t which, uint8_t group, uint8_t pin)
 {
 	// Verify servo is active.
 	if (which >= ACTIVE_SERVOS) {
 		return;
 	}
 
+#if SERVO_HW_OUTPUTS
+	if (which < HW_SERVOS) {
+		group = NO_GROUP;
+		pin = which == 0 ? PB1 : PB2;
+		DDRB |= _BV(pin);
+	}
+	else
+#endif
+	if (pin_free(which, group, pin)) {
+		// The PORTx bit is left alone: it is zero from reset, and
+		// the ISR toggles it from then on.
+		*groups[group].ddr |= _BV(pin);
+	}
+	else {
+		return;
+	}
+
+	stop_motion(which);
+	servos[which].group = group;
 	servos[which].pin = pin;
+	servos[which].tcnt = MID_PULSE * 2;
 	servos[which].min = MIN_PULSE;
 	servos[which].max = MAX_PULSE;
 	servos[which].trim = 0;
+	servos[which].vmax = MOTION_VMAX;
+	servos[which].accel = MOTION_ACCEL;
+	update_servo(which);
 }
 
+
 void
 set_limits(uint8_t which, uint16_t min, uint16_t max)
 {
@@ -111,11 +596,11 @@ set_limits(uint8_t which, uint16_t min, uint16_t max)
 		return;
 	}
 
-	if (min > 0) {
+	if (min >= PULSE_FLOOR) {
 		servos[which].min = min;
 	}
 
-	if (max > 0) {
+	if (max > 0 && max <= PULSE_CEILING) {
 		servos[which].max = max;
 	}
 }
@@ -147,16 +632,11 @@ servo_min(uint8_t which)
 }
 
 
-void
-set_servo(uint8_t which, uint32_t us)
+// pulse_ticks works out the pulse a servo should be given for a request
+// of us microseconds, after its trim and limits are applied.
+static uint16_t
+pulse_ticks(uint8_t which, uint32_t us)
 {
-	uint8_t	saved_SREG;
-
-	// Verify that a valid servo is being addressed.
-	if (which >= ACTIVE_SERVOS) {
-		return;
-	}
-
 	us += servos[which].trim;
 
 	// Verify that pulse time is within acceptable limits.
@@ -167,12 +647,48 @@ set_servo(uint8_t which, uint32_t us)
 		us = servos[which].max;
 	}
 
-	us *= 2;
-	saved_SREG = SREG;
-	cli();
-	servos[which].tcnt = us;
-	SREG = saved_SREG;
-	sei();
+	return (uint16_t)(us * 2);
+}
+
+
+void
+set_servo(uint8_t which, uint32_t us)
+{
+	// Verify that a valid servo is being addressed.
+	if (which >= ACTIVE_SERVOS) {
+		return;
+	}
+
+	stop_motion(which);
+	servos[which].tcnt = pulse_ticks(which, us);
+	update_servo(which);
+}
+
+
+// set_servos sets each servo whose bit is set in which to the pulse width,
+// in microseconds, given for it in us, which is indexed by servo. The
+// servos driven by the event tables all take their new settings on the
+// same frame.
+void
+set_servos(uint16_t which, const uint16_t *us)
+{
+	uint8_t	i;
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		if (!(which & _BV(i))) {
+			continue;
+		}
+
+		stop_motion(i);
+		servos[i].tcnt = pulse_ticks(i, us[i]);
+#if SERVO_HW_OUTPUTS
+		if (i < HW_SERVOS) {
+			set_compare(i);
+		}
+#endif
+	}
+
+	publish_servos();
 }
 
 
@@ -184,52 +700,795 @@ get_servo(uint8_t which)
 		return 0;
 	}
 
-	return (uint16_t)servos[which].tcnt;
+	return servos[which].tcnt;
 }
 
 
-// The following are the interrupt handlers for timer 1.
-static void
-timer1ISR(void)
+// set_motion_limits sets the top speed and acceleration, in microseconds
+// per second and microseconds per second per second, that moves of the
+// servo are held to. A move already under way keeps its old limits.
+void
+set_motion_limits(uint8_t which, uint16_t vmax, uint16_t accel)
 {
-	if (active < ACTIVE_SERVOS) {
-		// Pulse active pin low.
-		PORTB &= ~_BV(servos[active].pin);
+	// Verify servo is active.
+	if (which >= ACTIVE_SERVOS || vmax == 0 || accel == 0) {
+		return;
 	}
-	// The PWM cycle is complete, reset timer.
-	else {
-		active = -1;
-		TCNT1 = 0;
+
+	servos[which].vmax = vmax;
+	servos[which].accel = accel;
+}
+
+
+// move_servos starts moving each servo whose bit is set in which towards
+// the pulse width, in microseconds, given for it in us, which is indexed
+// by servo. The servos move as one motion, so they all arrive together;
+// the servos' own trim and limits apply to the targets as with set_servo.
+// The move is made by motion_poll, a frame at a time.
+void
+move_servos(uint16_t which, const uint16_t *us)
+{
+	struct motion	*m;
+	uint32_t	 vmax = UINT32_MAX;
+	uint32_t	 accel = UINT32_MAX;
+	uint32_t	 limit;
+	uint16_t	 dist;
+	uint8_t		 i, n;
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		if (which & _BV(i)) {
+			stop_motion(i);
+		}
 	}
 
-	active++;
-	if (active < ACTIVE_SERVOS) {
-		OCR1A = TCNT1 + servos[active].tcnt;
-		PORTB |= _BV(servos[active].pin);
+	// With every servo being moved taken out of its old motion, at
+	// least one motion must be free.
+	for (n = 0; motions[n].servos != 0; n++) {}
+	m = &motions[n];
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		if (!(which & _BV(i))) {
+			continue;
+		}
+
+		servos[i].start = servos[i].tcnt;
+		servos[i].delta = pulse_ticks(i, us[i]) - servos[i].tcnt;
+		if (servos[i].delta == 0) {
+			continue;
+		}
+
+		// A servo's limits, in microseconds, become limits on the
+		// progress by scaling them to ticks per frame and dividing
+		// by the distance the servo has to go, in ticks.
+		dist = servos[i].delta < 0 ? -servos[i].delta :
+		    servos[i].delta;
+		limit = servos[i].vmax * (2 * MOTION_ONE / FRAME_RATE) / dist;
+		if (limit < vmax) {
+			vmax = limit;
+		}
+
+		limit = servos[i].accel * (2 * MOTION_ONE / FRAME_RATE) /
+		    FRAME_RATE / dist;
+		if (limit < accel) {
+			accel = limit;
+		}
+
+		servos[i].motion = n;
+		m->servos |= _BV(i);
 	}
-	// Pulsing complete, don't pulse until the update interval is over.
-	else {
-		if ((TCNT1 + UPDATE_WAIT) < UPDATE_INTERVAL) {
-			OCR1A = UPDATE_INTERVAL;
+
+	m->s = 0;
+	m->v = 0;
+	m->vmax = vmax > 0 ? vmax : 1;
+	m->accel = accel > 0 ? accel : 1;
+	m->ramp = 0;
+	m->phase = MOTION_ACCEL_PHASE;
+}
+
+
+// move_servo starts a single servo moving towards a new pulse width.
+void
+move_servo(uint8_t which, uint16_t us)
+{
+	uint16_t	targets[ACTIVE_SERVOS];
+
+	// Verify that a valid servo is being addressed.
+	if (which >= ACTIVE_SERVOS) {
+		return;
+	}
+
+	targets[which] = us;
+	move_servos(_BV(which), targets);
+}
+
+
+// servo_moving returns true while a servo is still being moved.
+bool
+servo_moving(uint8_t which)
+{
+	if (which >= ACTIVE_SERVOS) {
+		return false;
+	}
+
+	return servos[which].motion != NO_MOTION;
+}
+
+
+// motion_step advances a motion by one frame, returning false once it
+// has arrived. The profile speeds up until it reaches its top speed,
+// cruises, and then slows down to arrive; a short move may never reach
+// its top speed at all.
+static bool
+motion_step(struct motion *m)
+{
+	uint32_t	left;
+
+	if (m->phase == MOTION_DECEL) {
+		// The speed never drops below one step of acceleration, so
+		// any of the move left over by rounding is still finished.
+		if (m->v > 2 * m->accel) {
+			m->v -= m->accel;
 		}
 		else {
-			OCR1A = TCNT1 + UPDATE_WAIT;
+			m->v = m->accel;
+		}
+	}
+	else if (m->phase == MOTION_ACCEL_PHASE) {
+		m->v += m->accel;
+		if (m->v >= m->vmax) {
+			m->v = m->vmax;
+			m->phase = MOTION_CRUISE;
+		}
+		m->ramp += m->v;
+	}
+
+	m->s += m->v;
+	if (m->s >= MOTION_ONE) {
+		m->s = MOTION_ONE;
+		return false;
+	}
+
+	// Once what is left of the move is no more than it took to get up to
+	// speed, the motion starts slowing down. The rate is worked out
+	// afresh from what is actually left, so that the speed runs out
+	// just as the motion arrives; it comes to no more than the
+	// acceleration.
+	left = MOTION_ONE - m->s;
+	if (m->phase != MOTION_DECEL && left <= m->ramp) {
+		m->accel = m->v / (2 * left / m->v + 1);
+		if (m->accel == 0) {
+			m->accel = 1;
+		}
+		m->phase = MOTION_DECEL;
+	}
+	return true;
+}
+
+
+// motion_poll steps every motion under way once for each 20ms that the
+// ISR has finished since it was last called, whatever the groups' periods,
+// and hands the servos' new positions to the ISR in time for the next
+// frame. It should be called from the main loop at least once a frame.
+void
+motion_poll(void)
+{
+	struct motion	*m;
+	struct servo	*sv;
+	uint16_t	 moved = 0;
+	uint8_t		 i, n;
+	bool		 moving;
+
+	while ((uint8_t)(slot_count - motion_slot) >= FRAME_SLOTS) {
+		motion_slot += FRAME_SLOTS;
+
+		for (n = 0; n < ACTIVE_SERVOS; n++) {
+			m = &motions[n];
+			if (m->servos == 0) {
+				continue;
+			}
+
+			moving = motion_step(m);
+			for (i = 0; i < ACTIVE_SERVOS; i++) {
+				if (!(m->servos & _BV(i))) {
+					continue;
+				}
+
+				sv = &servos[i];
+				sv->tcnt = sv->start + (int16_t)(((int32_t)sv->delta *
+				    (int32_t)(m->s >> 4)) >> 16);
+				moved |= _BV(i);
+				if (!moving) {
+					sv->motion = NO_MOTION;
+				}
+			}
+
+			if (!moving) {
+				m->servos = 0;
+			}
+		}
+	}
+
+	if (moved == 0) {
+		return;
+	}
+
+#if SERVO_HW_OUTPUTS
+	for (i = 0; i < HW_SERVOS; i++) {
+		if (moved & _BV(i)) {
+			set_compare(i);
+		}
+	}
+	moved &= ~(_BV(HW_SERVOS) - 1);
+#endif
+
+	if (moved != 0) {
+		publish_servos();
+	}
+}
+
+
+#if SERVO_HW_OUTPUTS
+// The PWM subsystem uses Timer1 with a prescaler of 8, so that it counts
+// half microseconds. In this build it runs in fast PWM mode with ICR1 as
+// the top value, and OC1A and OC1B are set at the start of every frame
+// and cleared at their compare values by the timer itself, with no ISR
+// involved. The event tables run on Timer2 instead; see initTimer2.
+static void
+initTimer1(void)
+{
+	// Disable powersaving mode on Timer1 to enable it.
+	PRR &= ~_BV(PRTIM1);
+
+	// Clear OC1A and OC1B on compare match, set them at BOTTOM.
+	TCCR1A = _BV(COM1A1) | _BV(COM1B1) | _BV(WGM11);
+	TCCR1B = _BV(WGM13) | _BV(WGM12);	// Fast PWM mode 14, TOP = ICR1.
+	ICR1 = FRAME_TICKS - 1;
+
+	TCNT1 = 0;		// Reset the timer counter.
+	TCCR1B |= _BV(CS11);	// Set prescaler to 8, starting the timer.
+}
+
+
+// Timer2 runs the event tables for the software servos. It also counts
+// half microseconds, with a prescaler of 8, but it only has eight bits, so
+// it can't count out a whole frame. Instead, it runs freely and the ISR
+// moves its compare value forward by at most SOFT_MAX ticks at a time; a
+// wait longer than that is made up of several steps, and only the last one
+// runs an event. soft_wait is the number of ticks left before the next
+// event once the current step is over. The software servos' frame has the
+// same length as Timer1's, but the two aren't aligned.
+static uint16_t	soft_wait;
+
+// A long wait is taken in steps of up to SOFT_MAX ticks, but never so that
+// what is left is shorter than EVENT_MIN_GAP; when it would be, a shorter
+// step of SOFT_STEP ticks is taken instead. SOFT_MAX leaves room for
+// EVENT_LEAD in the ISR's eight-bit lead check.
+#define SOFT_MAX	(255 - EVENT_LEAD)
+#define SOFT_STEP	128
+
+
+static void
+initTimer2(void)
+{
+	// Disable powersaving mode on Timer2 to enable it.
+	PRR &= ~_BV(PRTIM2);
+
+	TCCR2A = 0;		// Normal mode.
+	TCCR2B = 0;
+	TCNT2 = 0;
+
+	// The first frame's events are counted from the first compare
+	// match.
+	OCR2A = SOFT_STEP;
+	soft_wait = table->ocr[0];
+	TIFR2 = _BV(OCF2A);	// Drop any existing interrupts on the timer.
+	TIMSK2 |= _BV(OCIE2A);	// Enable Timer2's output compare interrupt.
+
+	TCCR2B |= _BV(CS21);	// Set prescaler to 8, starting the timer.
+}
+#else
+// The PWM subsystem uses Timer1 with a prescaler of 8, so that it counts
+// half microseconds. Frames aren't all the same length, so it runs freely
+// in normal mode, and the ISR keeps the count at which the current frame
+// started in frame_start; each compare value is set relative to it, and
+// wraps along with the counter.
+static uint16_t	frame_start = 0;
+
+
+static void
+initTimer1(void)
+{
+	// Disable powersaving mode on Timer1 to enable it.
+	PRR &= ~_BV(PRTIM1);
+
+	TCCR1A = 0;		// Normal mode.
+	TCCR1B = 0;
+
+	// Now, Timer1 must be prepared for use.
+	TCNT1 = 0;		// Reset the timer counter.
+	OCR1A = table->ocr[0];	// The first frame starts at zero.
+	TIFR1 = _BV(OCF1A);	// Drop any existing interrupts on the timer.
+	TIMSK1 |= _BV(OCIE1A);	// Enable Timer1's output compare interrupt.
+
+	TCCR1B |= _BV(CS11);	// Set prescaler to 8, starting the timer.
+}
+#endif
+
+
+// next_frame is called by the ISR at the end of each frame to pick up the
+// table for the next one.
+static inline void
+next_frame(void)
+{
+	struct servo_table	*t;
+
+	frame_count++;
+	t = &tables[snapshot_take(&table_pub)];
+	if (t != table) {
+		table = t;
+		if (ack_waiting && (int16_t)(t->seq - ack_table) >= 0) {
+			ack_frame = frame_count;
+			ack_waiting = false;
 		}
 	}
 }
 
 
-// Install the ISR.
+#if SERVO_PROFILE
+// In a profiling build, the ISR records the range of edge latencies, from
+// the compare match to the pin write, and the most time it has taken from
+// the compare match it was entered for to the end of its body. Counting
+// from the match takes in the interrupt response and the ISR's register
+// saves; only the restores and return at the very end are left out. Both
+// are measured in CPU cycles.
+//
+// The cycles are counted by putting two timers together. Timer0 counts
+// every cycle but only has eight bits; the servo timer counts in eights,
+// so eight times its count gives the high bits of a cycle count, and
+// Timer0 the low ones. The two overlap in bits 3-7, which settles which
+// side of a servo timer tick the pair was read on. cycle_skew is the
+// difference between the two, found once at startup; it is only known to
+// within a few cycles, which shifts every latency by the same amount but
+// doesn't touch the jitter or the ISR's cost.
+//
+// Timer2 only has eight bits, so with hardware outputs the cycle count
+// wraps every 2048 cycles; CYCLE_MASK keeps the differences in range.
+#if SERVO_HW_OUTPUTS
+#define PROFILE_TCNT	TCNT2
+#define CYCLE_MASK	0x07FF
+#else
+#define PROFILE_TCNT	TCNT1
+#define CYCLE_MASK	0xFFFF
+#endif
+
+static uint8_t			cycle_skew;
+static volatile uint16_t	lat_min = 0xFFFF;
+static volatile uint16_t	lat_max = 0;
+static volatile uint16_t	isr_max = 0;
+
+
+// cycles returns the current cycle count. Timer0 is read first, and the
+// servo timer can tick over before it is read in turn, so the low byte is
+// taken from Timer0, and the servo timer's count only picks the 256-cycle
+// stretch it falls in: the one that puts it closest to eight times the
+// count.
+static inline uint16_t
+cycles(void)
+{
+	uint8_t		low = TCNT0 - cycle_skew;
+	uint16_t	high = (uint16_t)PROFILE_TCNT << 3;
+
+	return high + (int8_t)(uint8_t)(low - (uint8_t)high);
+}
+
+
+// initTimer0 starts Timer0 counting CPU cycles, and lines it up with the
+// servo timer, which must already be running.
+static void
+initTimer0(void)
+{
+	uint8_t	low;
+
+	TCCR0A = 0;
+	TCCR0B = _BV(CS00);
+
+	low = TCNT0;
+	cycle_skew = low - (uint8_t)(PROFILE_TCNT << 3);
+}
+
+
+// record_latency records the latency of an edge that was due at the given
+// count of the servo timer.
+static inline void
+record_latency(uint16_t due)
+{
+	uint16_t	lat = (cycles() - (due << 3)) & CYCLE_MASK;
+
+	if (lat < lat_min) {
+		lat_min = lat;
+	}
+	if (lat > lat_max) {
+		lat_max = lat;
+	}
+}
+
+
+// record_isr records the time the ISR has taken since the compare match
+// it was entered for.
+static inline void
+record_isr(uint16_t due)
+{
+	uint16_t	taken = (cycles() - (due << 3)) & CYCLE_MASK;
+
+	if (taken > isr_max) {
+		isr_max = taken;
+	}
+}
+#endif
+
+
+#if SERVO_HW_OUTPUTS
+// The Timer2 compare interrupt either takes another step through a long
+// wait or, once the wait is over, makes the next event's pin changes and
+// works out the wait for the one after it. As with the Timer1 ISR, every
+// edge takes the same path, so each is made the same fixed time after its
+// compare match.
+//
+// The new compare match is checked against how far the count has got
+// since the one being handled. An event made early can leave the count
+// just short of the compare value handled, so EVENT_LEAD is added before
+// the subtraction rather than after it. No step is longer than SOFT_MAX,
+// so a match missed by as much as SOFT_MAX ticks still reads as missed.
+// Any flag left over from the old compare value is cleared as the new one
+// is set; with EVENT_LEAD ticks in hand, the flag can't be for the new
+// value yet.
+ISR(TIMER2_COMPA_vect)
+{
+	uint8_t	i;
+	uint8_t	step, prev;
+#if SERVO_PROFILE
+	uint8_t	due = OCR2A;
+#endif
+
+	do {
+		if (soft_wait == 0) {
+			i = next_event;
+			*table->pin[i] = table->mask[i];
+
+#if SERVO_PROFILE
+			if (table->mask[i] != 0) {
+				record_latency(OCR2A);
+			}
+#endif
+
+			if (++i == table->count) {
+				soft_wait = table->ticks - table->ocr[i - 1];
+				slot_count += table->slots;
+				next_frame();
+				i = 0;
+				soft_wait += table->ocr[0];
+			}
+			else {
+				soft_wait = table->ocr[i] - table->ocr[i - 1];
+			}
+			next_event = i;
+		}
+
+		if (soft_wait >= SOFT_MAX + EVENT_MIN_GAP) {
+			step = SOFT_MAX;
+		}
+		else if (soft_wait > SOFT_MAX) {
+			step = SOFT_STEP;
+		}
+		else {
+			step = soft_wait;
+		}
+		prev = OCR2A;
+		OCR2A = prev + step;
+		TIFR2 = _BV(OCF2A);
+		soft_wait -= step;
+	} while ((uint8_t)(TCNT2 + EVENT_LEAD - prev) > step);
+
+#if SERVO_PROFILE
+	record_isr(due);
+#endif
+}
+#else
+// The following are the interrupt handlers for timer 1. Each compare
+// match makes one event's pin changes and sets up the next. Every edge
+// takes the same path through the ISR, so each is made the same fixed
+// time after its compare match and pulse widths come out exact; only the
+// closing event, which changes no pins, takes the branch that moves on to
+// the next frame's table.
+//
+// If the next event's compare match isn't EVENT_LEAD ticks ahead of the
+// count, it is made straight away. As with the Timer2 stepper, the count
+// is measured from the compare value just handled, not from the new one:
+// the gap to the closing event can be well over half the timer's range,
+// and a signed difference from the new value would read such a distant
+// match as already passed. An event made early can leave the count just
+// short of the compare value handled, so EVENT_LEAD is added before the
+// subtraction rather than after it. Any flag left over from the old
+// compare value is cleared as the new one is set; with EVENT_LEAD ticks
+// in hand, the flag can't be for the new value yet.
+static void
+timer1ISR(void)
+{
+	uint8_t		i = next_event;
+	uint16_t	prev, next;
+
+	do {
+		*table->pin[i] = table->mask[i];
+
+#if SERVO_PROFILE
+		if (table->mask[i] != 0) {
+			record_latency(frame_start + table->ocr[i]);
+		}
+#endif
+
+		if (++i == table->count) {
+			frame_start += table->ticks;
+			slot_count += table->slots;
+			next_frame();
+			i = 0;
+		}
+
+		prev = OCR1A;
+		next = frame_start + table->ocr[i];
+		OCR1A = next;
+		TIFR1 = _BV(OCF1A);
+	} while ((uint16_t)(TCNT1 + EVENT_LEAD - prev) >
+	    (uint16_t)(next - prev));
+	next_event = i;
+}
+
+
+// Install the ISR. In a profiling build, the compare value it was entered
+// for is noted first, so that its time can be counted from the match.
 ISR(TIMER1_COMPA_vect)
 {
+#if SERVO_PROFILE
+	uint16_t	due = OCR1A;
+#endif
+
 	timer1ISR();
+
+#if SERVO_PROFILE
+	record_isr(due);
+#endif
 }
+#endif
+
+
+#if SERVO_PROFILE
+// report_profile writes out and resets the ISR measurements.
+static void
+report_profile(void)
+{
+	uint16_t	lo, hi, isr;
+	uint8_t		saved_SREG;
+
+	saved_SREG = SREG;
+	cli();
+	lo = lat_min;
+	hi = lat_max;
+	isr = isr_max;
+	lat_min = 0xFFFF;
+	lat_max = 0;
+	isr_max = 0;
+	SREG = saved_SREG;
+
+	write_string_P(PSTR("edge latency "));
+	write_uint(lo, 0);
+	serial_write('-');
+	write_uint(hi, 0);
+	write_string_P(PSTR(" cycles, jitter "));
+	write_uint(hi - lo, 0);
+	write_string_P(PSTR(", ISR max "));
+	write_uint(isr, 0);
+	write_string_P(PSTR(" cycles"));
+	newline();
+}
+#endif
+
+
+// The host drives the servos with binary command frames, laid out in
+// telemetry.h. Each command is answered with the number of the frame on
+// which it took effect, which isn't known until the ISR has picked up the
+// table holding it; no new command is read until then, so a host sending
+// one command per frame never has more than one waiting. The table may be
+// replaced by a later one, from motion_poll, before the ISR gets to it,
+// so the frame answered is the first on which a table at least as new as
+// the command's was used.
+//
+// With hardware outputs, the compare-output servos take new settings at
+// the start of Timer1's own frame, which isn't aligned with the frame
+// numbers given in the answers.
+static struct telemetry_rx	cmd_rx;
+static bool			ack_pending = false;
+static uint8_t			ack_seq;
+
+
+static void
+send_ack(uint8_t seq, uint8_t status, uint16_t frame)
+{
+	uint8_t	payload[TELEMETRY_SERVO_ACK_SIZE];
+
+	payload[0] = seq;
+	payload[1] = status;
+	payload[2] = (uint8_t)frame;
+	payload[3] = (uint8_t)(frame >> 8);
+	telemetry_send(TELEMETRY_SERVO_ACK, frame, payload, sizeof(payload));
+}
+
+
+// read_frame_count returns one of the ISR's 16-bit frame numbers, which
+// have to be read with the ISR kept out.
+static uint16_t
+read_frame_count(volatile uint16_t *count)
+{
+	uint16_t	n;
+	uint8_t		saved_SREG;
+
+	saved_SREG = SREG;
+	cli();
+	n = *count;
+	SREG = saved_SREG;
+	return n;
+}
+
+
+// run_command carries out a servo command, returning its status.
+static uint8_t
+run_command(const struct telemetry_frame *cmd)
+{
+	uint16_t	targets[ACTIVE_SERVOS];
+	uint16_t	which;
+	uint8_t		i, n = 0;
+
+	if (cmd->type != TELEMETRY_SERVO_SET &&
+	    cmd->type != TELEMETRY_SERVO_MOVE) {
+		return TELEMETRY_ACK_UNKNOWN;
+	}
+
+	if (cmd->len < TELEMETRY_SERVO_SIZE(0)) {
+		return TELEMETRY_ACK_BAD;
+	}
+
+	which = cmd->payload[0] | ((uint16_t)cmd->payload[1] << 8);
+	if (which >= _BV(ACTIVE_SERVOS)) {
+		return TELEMETRY_ACK_BAD;
+	}
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		if (!(which & _BV(i))) {
+			continue;
+		}
+
+		if (cmd->len < TELEMETRY_SERVO_SIZE(n + 1)) {
+			return TELEMETRY_ACK_BAD;
+		}
+
+		targets[i] = cmd->payload[2 + 2 * n] |
+		    ((uint16_t)cmd->payload[3 + 2 * n] << 8);
+		n++;
+	}
+
+	if (cmd->len != TELEMETRY_SERVO_SIZE(n)) {
+		return TELEMETRY_ACK_BAD;
+	}
+
+	if (cmd->type == TELEMETRY_SERVO_SET) {
+		set_servos(which, targets);
+	}
+	else {
+		// Publishing now marks the frame the move starts on; its
+		// first step comes from motion_poll.
+		move_servos(which, targets);
+		publish_servos();
+	}
+
+	return TELEMETRY_ACK_OK;
+}
+
+
+// poll_commands answers the last command once it has taken effect, and
+// then carries out the next one, if one has come in.
+static void
+poll_commands(void)
+{
+	struct telemetry_frame	cmd;
+	uint8_t			status;
+
+	if (ack_pending) {
+		if (ack_waiting) {
+			return;
+		}
+
+		// The ISR is done with ack_frame once it clears
+		// ack_waiting.
+		send_ack(ack_seq, TELEMETRY_ACK_OK, ack_frame);
+		ack_pending = false;
+	}
+
+	if (!telemetry_receive(&cmd_rx, &cmd)) {
+		return;
+	}
+
+	// The command's table will be the next one published; the ISR is
+	// told to watch for it before it can possibly go live.
+	ack_table = table_seq + 1;
+	ack_waiting = true;
+
+	status = run_command(&cmd);
+	if (status == TELEMETRY_ACK_OK) {
+		ack_seq = cmd.seq;
+		ack_pending = true;
+	}
+	else {
+		// Nothing was published, so the ISR can't have seen a table
+		// as new as ack_table.
+		ack_waiting = false;
+		send_ack(cmd.seq, status, read_frame_count(&frame_count));
+	}
+}
+
+
+// The servos are connected to the first pins of each group in turn. The
+// first two are on PB1 and PB2 so that the same wiring works with the
+// hardware outputs.
+static const uint8_t	servo_pins[ACTIVE_SERVOS][2] = {
+	{0, PB1}, {0, PB2}, {0, PB0}, {0, PB3}, {0, PB4}, {0, PB5},
+	{1, PD2}, {1, PD3}, {1, PD4}, {1, PD5}, {1, PD6}, {1, PD7},
+};
 
 
 int
 main(void)
 {
-	while (1) {}
+	uint8_t	i;
+#if SERVO_PROFILE
+	uint8_t	reported = 0;
+	uint8_t	frames = 0;
+#endif
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		servos[i].group = NO_GROUP;
+		servos[i].motion = NO_MOTION;
+	}
+
+	// Start the ISR off with an empty frame.
+	publish_servos();
+	table = &tables[snapshot_take(&table_pub)];
+
+	for (i = 0; i < ACTIVE_SERVOS; i++) {
+		connect(i, servo_pins[i][0], servo_pins[i][1]);
+	}
+
+	initTimer1();
+#if SERVO_HW_OUTPUTS
+	initTimer2();
+#endif
+#if SERVO_PROFILE
+	initTimer0();
+#endif
+	init_UART();
+	sei();
+
+	while (1) {
+		poll_commands();
+		motion_poll();
+
+#if SERVO_PROFILE
+		if ((uint8_t)(slot_count - reported) >= FRAME_SLOTS) {
+			reported += FRAME_SLOTS;
+			if (++frames == FRAME_RATE) {
+				frames = 0;
+				report_profile();
+			}
+		}
+#endif
+	}
 
 	return 0;
 }
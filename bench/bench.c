@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "bench.h"
+#include "fmt.h"
+#include "serial.h"
+
+
+/*
+ * bench_init starts Timer1 counting cycles.
+ */
+void
+bench_init(void)
+{
+	/* Normal mode, with no prescaling. */
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+}
+
+
+void
+cycles_clear(struct cycles *c)
+{
+	c->total = 0;
+	c->max = 0;
+	c->n = 0;
+}
+
+
+/*
+ * cycles_add adds one timed stretch to a measurement.
+ */
+void
+cycles_add(struct cycles *c, uint16_t elapsed)
+{
+	c->total += elapsed;
+	if (elapsed > c->max) {
+		c->max = elapsed;
+	}
+	c->n++;
+}
+
+
+/*
+ * cycles_report writes out a measurement as "label cycles/unit: avg a,
+ * max m". Both strings are in flash.
+ */
+void
+cycles_report(const char *label, const char *unit, struct cycles *c)
+{
+	write_string_P(label);
+	write_string_P(PSTR(" cycles/"));
+	write_string_P(unit);
+	write_string_P(PSTR(": avg "));
+	write_uint(c->n == 0 ? 0 : c->total / c->n, 0);
+	write_string_P(PSTR(", max "));
+	write_uint(c->max, 0);
+	newline();
+}
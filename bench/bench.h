@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * bench holds the cycle-counting scaffolding shared by the benchmarks.
+ * Timer1 runs at the CPU clock, so it counts cycles directly. A timed
+ * stretch is bracketed by bench_start and bench_stop, which keep
+ * interrupts off in between so that the serial interrupt doesn't get
+ * counted against it; it must be shorter than 65536 cycles.
+ */
+
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+
+
+/*
+ * A cycle measurement is the running total and the worst case over the
+ * n stretches timed.
+ */
+struct cycles {
+	uint32_t	total;
+	uint16_t	max;
+	uint16_t	n;
+};
+
+
+static inline uint16_t
+bench_start(void)
+{
+	cli();
+	return TCNT1;
+}
+
+
+static inline uint16_t
+bench_stop(uint16_t start)
+{
+	uint16_t	elapsed = TCNT1 - start;
+
+	sei();
+	return elapsed;
+}
+
+
+void	bench_init(void);
+void	cycles_clear(struct cycles *c);
+void	cycles_add(struct cycles *c, uint16_t elapsed);
+void	cycles_report(const char *label, const char *unit, struct cycles *c);
+
+
+#endif
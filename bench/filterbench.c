@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * filterbench times each stage of the sensor filter in filter.c, one
+ * sample at a time, as the ADC interrupt in 05_urs runs it. The samples
+ * are a made-up ultrasonic trace with jitter and the odd outlier. The
+ * timings include the call itself.
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+#include "bench.h"
+#include "filter.h"
+#include "fmt.h"
+#include "serial.h"
+
+
+#define NSAMPLES	16
+
+static const uint16_t	samples[NSAMPLES] = {
+	812, 815, 809, 4011, 813, 818, 811, 0,
+	806, 810, 1620, 804, 801, 797, 799, 795
+};
+
+
+static struct filter	filter;
+
+
+static void
+stage_median(uint16_t x)
+{
+	median_update(&filter.median, x);
+}
+
+
+static void
+stage_iir(uint16_t x)
+{
+	iir_update(&filter.iir, x);
+}
+
+
+static void
+stage_filter(uint16_t x)
+{
+	filter_update(&filter, x);
+}
+
+
+/*
+ * measure runs every sample through stage, timing each one.
+ */
+static void
+measure(void (*stage)(uint16_t), struct cycles *c)
+{
+	uint16_t	start;
+	uint8_t		i;
+
+	cycles_clear(c);
+	for (i = 0; i < NSAMPLES; i++) {
+		start = bench_start();
+		stage(samples[i]);
+		cycles_add(c, bench_stop(start));
+	}
+}
+
+
+static void
+report(const char *label, struct cycles *c)
+{
+	cycles_report(label, PSTR("sample"), c);
+}
+
+
+int
+main(void)
+{
+	struct cycles	c;
+
+	init_UART();
+	bench_init();
+	sei();
+
+	write_string_P(PSTR("filterbench, median of "));
+	write_uint(FILTER_MEDIAN, 0);
+	newline();
+
+	/* Prime the filter so that every stage starts out full. */
+	filter_init(&filter, 3);
+	filter_update(&filter, samples[0]);
+
+	while (1) {
+		_delay_ms(1000);
+
+		measure(stage_median, &c);
+		report(PSTR("median"), &c);
+		measure(stage_iir, &c);
+		report(PSTR("iir"), &c);
+		measure(stage_filter, &c);
+		report(PSTR("median+iir"), &c);
+	}
+
+	return 0;
+}
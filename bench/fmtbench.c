@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * fmtbench compares the cost of writing a URS report line with
+ * snprintf, as 05_urs used to, against the fmt writers. Both paths
+ * write the same lines for a set of sample readings.
+ *
+ * The flash cost shows up in the avr-size output at the end of the
+ * build. Building with "make TARGET=fmtbench
+ * BENCHFLAGS=-DBENCH_SNPRINTF=0" leaves out the snprintf path, and with
+ * it vfprintf; the difference between the two builds is what snprintf
+ * costs.
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "fmt.h"
+#include "serial.h"
+
+
+#ifndef BENCH_SNPRINTF
+#define BENCH_SNPRINTF	1
+#endif
+
+
+#define NSAMPLES	8
+
+static const uint16_t	sample_count[NSAMPLES] = {
+	0, 1, 42, 999, 1234, 20000, 54321, 65535
+};
+
+static const uint8_t	sample_val[NSAMPLES] = {
+	0, 7, 99, 128, 200, 255, 13, 64
+};
+
+
+#if BENCH_SNPRINTF
+static void
+line_snprintf(uint16_t count, uint8_t val)
+{
+	char	buf[32];
+
+	snprintf(buf, 31, "URS reading #%5u: %u\r\n", count, val);
+	write_string(buf);
+}
+#endif
+
+
+static void
+line_fmt(uint16_t count, uint8_t val)
+{
+	write_string_P(PSTR("URS reading #"));
+	write_uint(count, 5);
+	write_string_P(PSTR(": "));
+	write_uint(val, 0);
+	newline();
+}
+
+
+/*
+ * measure times one line written by line, adding it to c. The transmit
+ * buffer is emptied first so that the line never has to wait for room.
+ */
+static void
+measure(void (*line)(uint16_t, uint8_t), uint8_t i, struct cycles *c)
+{
+	uint16_t	start;
+
+	serial_flush();
+
+	start = bench_start();
+	line(sample_count[i], sample_val[i]);
+	cycles_add(c, bench_stop(start));
+}
+
+
+static void
+report(const char *label, struct cycles *c)
+{
+	cycles_report(label, PSTR("line"), c);
+}
+
+
+int
+main(void)
+{
+	struct cycles	fmt_cycles;
+	uint8_t		i;
+#if BENCH_SNPRINTF
+	struct cycles	snprintf_cycles;
+#endif
+
+	init_UART();
+	bench_init();
+	sei();
+
+	write_string_P(PSTR("fmtbench"));
+	newline();
+
+	while (1) {
+		_delay_ms(1000);
+
+		cycles_clear(&fmt_cycles);
+		for (i = 0; i < NSAMPLES; i++) {
+			measure(line_fmt, i, &fmt_cycles);
+		}
+
+#if BENCH_SNPRINTF
+		cycles_clear(&snprintf_cycles);
+		for (i = 0; i < NSAMPLES; i++) {
+			measure(line_snprintf, i, &snprintf_cycles);
+		}
+
+		report(PSTR("snprintf"), &snprintf_cycles);
+#endif
+		report(PSTR("fmt"), &fmt_cycles);
+	}
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * serialbench measures how fast the serial driver actually moves data.
+ * It queues a block of BENCH_BYTES bytes, times how long it takes for
+ * all of them to leave the UART, and reports the achieved rate against
+ * the theoretical line rate. With 8N1 framing, every byte takes ten
+ * bits on the wire, so the line rate is a tenth of the baud rate. Build
+ * it for the rate under test, e.g. "make TARGET=serialbench
+ * BAUD=1000000".
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+#include "fmt.h"
+#include "serial.h"
+
+
+#define BENCH_BYTES	2048
+
+
+/*
+ * Timer1 runs with a prescaler of 8, which gives 0.5 microseconds per
+ * tick. Counting its overflows extends it to 32 bits, which is long
+ * enough to time a block at the slowest baud rates.
+ */
+#define TICKS_PER_SEC	(F_CPU / 8UL)
+
+static volatile uint16_t	timer1_overflows = 0;
+
+
+static void
+init_timer1(void)
+{
+	/* Normal mode, with a prescaler of 8. */
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+
+	/* Trigger an interrupt on overflow. */
+	TIMSK1 |= _BV(TOIE1);
+}
+
+
+/*
+ * ticks returns the 32-bit tick count. If the timer has overflowed but
+ * the interrupt hasn't run yet, the overflow is counted here instead.
+ */
+static uint32_t
+ticks(void)
+{
+	uint8_t		saved_SREG;
+	uint16_t	hi, lo;
+
+	saved_SREG = SREG;
+	cli();
+	lo = TCNT1;
+	hi = timer1_overflows;
+	if (bit_is_set(TIFR1, TOV1) && (lo < 0x8000)) {
+		hi++;
+	}
+	SREG = saved_SREG;
+
+	return ((uint32_t)hi << 16) | lo;
+}
+
+
+ISR(TIMER1_OVF_vect)
+{
+	timer1_overflows++;
+}
+
+
+/*
+ * report writes out a number on its own line, after a label stored in
+ * flash.
+ */
+static void
+report(const char *label, uint32_t n)
+{
+	write_string_P(label);
+	write_uint(n, 0);
+	newline();
+}
+
+
+int
+main(void)
+{
+	uint32_t	start, elapsed;
+	uint32_t	achieved, line_rate;
+	uint16_t	i;
+
+	init_UART();
+	init_timer1();
+	sei();
+
+	write_string_P(PSTR("serialbench: "));
+	report(PSTR("baud: "), SERIAL_BAUD_ACTUAL);
+
+	line_rate = SERIAL_BAUD_ACTUAL / 10;
+
+	while (1) {
+		/*
+		 * Let the previous report drain so that the line is idle
+		 * when the timing starts.
+		 */
+		_delay_ms(1000);
+		serial_flush();
+		UCSR0A |= _BV(TXC0);
+
+		start = ticks();
+		for (i = 0; i < BENCH_BYTES; i++) {
+			serial_write('U');
+		}
+
+		/*
+		 * The block is done once the buffer is empty and the
+		 * transmit complete flag says the last stop bit is out.
+		 */
+		serial_flush();
+		loop_until_bit_is_set(UCSR0A, TXC0);
+		elapsed = ticks() - start;
+
+		newline();
+		achieved = ((uint32_t)BENCH_BYTES * TICKS_PER_SEC) / elapsed;
+		report(PSTR("bytes/s achieved: "), achieved);
+		report(PSTR("bytes/s line rate: "), line_rate);
+		report(PSTR("efficiency (%): "), (achieved * 100) / line_rate);
+	}
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "clock.h"
+#include "snapshot.h"
+
+
+/*
+ * The counts kept by the overflow interrupt: the number of overflows,
+ * and the time they add up to in whole milliseconds, plus the
+ * microseconds left over. clock_slept counts the overflows that found
+ * the CPU asleep, as marked by clock_sleeping.
+ */
+static struct snapshot		clock_snap;
+static volatile uint32_t	clock_overflows = 0;
+static volatile uint32_t	clock_ms = 0;
+static volatile uint16_t	clock_us = 0;
+static volatile uint32_t	clock_slept = 0;
+static volatile bool		clock_asleep = false;
+
+
+/*
+ * clock_init starts Timer0 and its overflow interrupt. The clock starts
+ * at zero, and runs once interrupts are enabled.
+ */
+void
+clock_init(void)
+{
+	PRR &= ~_BV(PRTIM0);
+
+	TCCR0A = 0;		/* Normal mode. */
+	TCCR0B = 0;
+	TCNT0 = 0;
+	TIFR0 = _BV(TOV0);
+	TIMSK0 = _BV(TOIE0);
+
+	TCCR0B = _BV(CS01) | _BV(CS00);	/* Prescaler of 64. */
+}
+
+
+/*
+ * clock_read copies out the counts along with the timer itself. If the
+ * timer has overflowed but the interrupt hasn't run yet, as happens
+ * when this is called with interrupts off, the overflow is counted here.
+ * The flag is checked after the timer is read, so a count of 255 was
+ * read before the overflow and doesn't need it.
+ */
+static void
+clock_read(uint32_t *overflows, uint32_t *ms, uint16_t *us, uint8_t *ticks)
+{
+	uint8_t	seq;
+
+	do {
+		seq = snapshot_read_begin(&clock_snap);
+		*overflows = clock_overflows;
+		*ms = clock_ms;
+		*us = clock_us;
+		*ticks = TCNT0;
+		if ((TIFR0 & _BV(TOV0)) && *ticks < 255) {
+			(*overflows)++;
+			*ms += CLOCK_OVERFLOW_US / 1000;
+			*us += CLOCK_OVERFLOW_US % 1000;
+		}
+	} while (snapshot_read_retry(&clock_snap, seq));
+}
+
+
+/*
+ * micros returns the time since the clock started, in microseconds. It
+ * only changes every CLOCK_TICK_US microseconds.
+ */
+uint32_t
+micros(void)
+{
+	uint32_t	overflows, ms;
+	uint16_t	us;
+	uint8_t		ticks;
+
+	clock_read(&overflows, &ms, &us, &ticks);
+	return ((overflows << 8) + ticks) * CLOCK_TICK_US;
+}
+
+
+/*
+ * millis returns the time since the clock started, in milliseconds.
+ */
+uint32_t
+millis(void)
+{
+	uint32_t	overflows, ms;
+	uint16_t	us;
+	uint8_t		ticks;
+
+	clock_read(&overflows, &ms, &us, &ticks);
+	us += (uint16_t)ticks * CLOCK_TICK_US;
+	while (us >= 1000) {
+		us -= 1000;
+		ms++;
+	}
+
+	return ms;
+}
+
+
+/*
+ * clock_sleeping marks the CPU as about to go to sleep, or as awake
+ * again.
+ */
+void
+clock_sleeping(bool asleep)
+{
+	clock_asleep = asleep;
+}
+
+
+/*
+ * clock_samples copies out the number of overflows so far, each of which
+ * is a sample, and how many of them found the CPU asleep.
+ */
+void
+clock_samples(uint32_t *taken, uint32_t *asleep)
+{
+	uint8_t	seq;
+
+	do {
+		seq = snapshot_read_begin(&clock_snap);
+		*taken = clock_overflows;
+		*asleep = clock_slept;
+	} while (snapshot_read_retry(&clock_snap, seq));
+}
+
+
+ISR(TIMER0_OVF_vect)
+{
+	uint8_t		late = TCNT0;
+	uint32_t	ms = clock_ms + CLOCK_OVERFLOW_US / 1000;
+	uint16_t	us = clock_us + CLOCK_OVERFLOW_US % 1000;
+
+	if (us >= 1000) {
+		us -= 1000;
+		ms++;
+	}
+
+	snapshot_write_begin(&clock_snap);
+	clock_overflows++;
+	clock_ms = ms;
+	clock_us = us;
+	if (clock_asleep && late < CLOCK_WAKE_TICKS) {
+		clock_slept++;
+	}
+	snapshot_write_end(&clock_snap);
+}
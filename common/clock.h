@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * clock is a shared time base, so that a project can timestamp samples
+ * and schedule work without giving a hardware timer over to it. It
+ * takes Timer0, running freely with a prescaler of 64, and counts its
+ * overflows; at 16 MHz, the timer ticks every 4us and overflows every
+ * 1.024ms. The overflow interrupt is the only one, and it only adds to
+ * the counts.
+ *
+ * micros and millis may be called from the main program or from an
+ * interrupt. micros wraps after a little over 71 minutes, and millis
+ * after a little over 49 days; as long as intervals are worked out by
+ * subtracting one reading from another in unsigned arithmetic, the wrap
+ * does no harm.
+ *
+ * The overflow interrupt also samples whether the CPU is asleep, which
+ * gives the share of time it spends awake. Whatever puts the CPU to
+ * sleep marks it with clock_sleeping around the sleep. A sample counts
+ * as asleep only if the overflow was taken straight away, within
+ * CLOCK_WAKE_TICKS of it: if another interrupt had woken the CPU and
+ * was still running, the overflow waits for it and the sample counts
+ * as awake. An interrupt that ends within that window of the overflow
+ * is missed, so short interrupts are undercounted slightly.
+ */
+
+
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#if !defined(F_CPU)
+#error "F_CPU must be defined to use the clock."
+#endif
+
+#define CLOCK_PRESCALE		64
+
+#if ((F_CPU) % 1000000UL) != 0 || (CLOCK_PRESCALE % ((F_CPU) / 1000000UL)) != 0
+#error "The clock needs F_CPU to be a whole number of MHz dividing 64."
+#endif
+
+/* CLOCK_TICK_US is the time between timer ticks, in microseconds. */
+#define CLOCK_TICK_US		(CLOCK_PRESCALE / ((F_CPU) / 1000000UL))
+#define CLOCK_OVERFLOW_US	(256UL * CLOCK_TICK_US)
+
+/*
+ * CLOCK_WAKE_TICKS covers waking from idle sleep and getting into the
+ * overflow interrupt, at 64 cycles a tick.
+ */
+#define CLOCK_WAKE_TICKS	2
+
+
+void		clock_init(void);
+uint32_t	micros(void);
+uint32_t	millis(void);
+void		clock_sleeping(bool asleep);
+void		clock_samples(uint32_t *taken, uint32_t *asleep);
+
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "clock.h"
+#include "event.h"
+
+
+#define QUEUE_MASK	(EVENT_QUEUE_SIZE - 1)
+
+
+/*
+ * The event queue is a ring buffer, like the serial driver's, except
+ * that there may be many producers: any interrupt, and the main program
+ * too. They are kept apart by posting with interrupts off. The main
+ * program is the only consumer, in event_loop.
+ */
+struct event {
+	void	(*handler)(uint8_t);
+	uint8_t	  arg;
+};
+
+static volatile struct event	queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t		queue_head = 0;
+static volatile uint8_t		queue_tail = 0;
+
+static volatile uint32_t	events_posted = 0;
+static volatile uint16_t	events_dropped = 0;
+
+/* The clock's samples where event_awake's last interval ended. */
+static uint32_t			awake_taken = 0;
+static uint32_t			awake_asleep = 0;
+
+
+/*
+ * event_post queues a call to handler with arg, returning false if the
+ * queue was full and the event was dropped. It may be called from an
+ * interrupt or from the main program.
+ */
+bool
+event_post(void (*handler)(uint8_t), uint8_t arg)
+{
+	uint8_t	saved_SREG;
+	uint8_t	next;
+	bool	queued = false;
+
+	saved_SREG = SREG;
+	cli();
+
+	next = (queue_head + 1) & QUEUE_MASK;
+	if (next == queue_tail) {
+		events_dropped++;
+	}
+	else {
+		queue[queue_head].handler = handler;
+		queue[queue_head].arg = arg;
+		queue_head = next;
+		events_posted++;
+		queued = true;
+	}
+
+	SREG = saved_SREG;
+	return queued;
+}
+
+
+/*
+ * idle sleeps until the next interrupt if nothing is queued. The check
+ * and the sleep have to be made with interrupts off, or an event posted
+ * between them would sit in the queue until some later interrupt woke
+ * the CPU. The instruction after sei always runs before any interrupt
+ * is taken, so the sleep is entered with interrupts on and the check
+ * still good.
+ *
+ * The clock is told the CPU is asleep for the length of the sleep. It
+ * is only marked awake again once the interrupt that woke it is over,
+ * but the clock's sampling allows for that.
+ */
+static void
+idle(void)
+{
+	cli();
+	if (queue_head != queue_tail) {
+		sei();
+		return;
+	}
+
+	clock_sleeping(true);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	clock_sleeping(false);
+}
+
+
+/*
+ * event_loop runs the handler for each event as it is taken from the
+ * queue, in the order they were posted, and sleeps whenever the queue
+ * is empty. It never returns; the main program hands over to it once it
+ * is set up.
+ */
+void
+event_loop(void)
+{
+	void	(*handler)(uint8_t);
+	uint8_t	arg;
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	clock_samples(&awake_taken, &awake_asleep);
+
+	while (1) {
+		if (queue_head == queue_tail) {
+			idle();
+			continue;
+		}
+
+		/*
+		 * The event is copied out before its slot is given back,
+		 * as a producer may fill it again straight away.
+		 */
+		handler = queue[queue_tail].handler;
+		arg = queue[queue_tail].arg;
+		queue_tail = (queue_tail + 1) & QUEUE_MASK;
+
+		handler(arg);
+	}
+}
+
+
+/*
+ * event_get_stats copies out the executor's counters. It must only be
+ * called from the main program.
+ */
+void
+event_get_stats(struct event_stats *stats)
+{
+	uint8_t	saved_SREG;
+
+	saved_SREG = SREG;
+	cli();
+	stats->posted = events_posted;
+	stats->dropped = events_dropped;
+	SREG = saved_SREG;
+}
+
+
+/*
+ * event_awake returns the share of the clock's samples since it was last
+ * called, or since event_loop started, that found the CPU awake, in
+ * tenths of a percent. Interrupts count as awake along with the main
+ * program. The samples come about once a millisecond, so it wants an
+ * interval of a second or so to mean much. It must only be called from
+ * the main program, and at least once an hour.
+ */
+uint16_t
+event_awake(void)
+{
+	uint32_t	taken, asleep;
+	uint32_t	n, awake;
+
+	clock_samples(&taken, &asleep);
+	n = taken - awake_taken;
+	awake = n - (asleep - awake_asleep);
+	awake_taken = taken;
+	awake_asleep = asleep;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	return (uint16_t)(awake * 1000 / n);
+}
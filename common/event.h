@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * event is a small run-to-completion executor. Interrupts post events
+ * to a bounded queue, and the main program runs their handlers in turn
+ * from event_loop, each to completion. With nothing queued, the CPU is
+ * put into idle sleep until the next interrupt, rather than spinning.
+ *
+ * The share of time the CPU spends awake, in interrupts as well as in
+ * the main program, is measured by the clock's sampling, so the clock
+ * must be running; projects using event.c also take in clock.c.
+ */
+
+
+#ifndef __EVENT_H
+#define __EVENT_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * EVENT_QUEUE_SIZE is the number of events that can be waiting. It
+ * must be a power of two no larger than 256; one entry is always left
+ * unused, as in the serial driver's buffers.
+ */
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE	16
+#endif
+
+#if (EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) != 0 || EVENT_QUEUE_SIZE > 256
+#error "EVENT_QUEUE_SIZE must be a power of two no larger than 256."
+#endif
+
+
+/*
+ * event_stats collects the executor's counters. posted counts the
+ * events queued, and dropped the events thrown away because the queue
+ * was full.
+ */
+struct event_stats {
+	uint32_t	posted;
+	uint16_t	dropped;
+};
+
+
+bool		event_post(void (*handler)(uint8_t), uint8_t arg);
+void		event_loop(void) __attribute__((noreturn));
+void		event_get_stats(struct event_stats *stats);
+uint16_t	event_awake(void);
+
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "filter.h"
+
+
+/*
+ * filter_init sets up a filter whose low-pass stage uses the given
+ * shift; the stages are filled by the first sample.
+ */
+void
+filter_init(struct filter *f, uint8_t shift)
+{
+	f->iir.shift = shift;
+	f->primed = false;
+}
+
+
+/*
+ * exchange puts a pair of samples in order without a branch. The borrow
+ * out of b - a fills the top half of the difference with ones exactly
+ * when a > b, which makes the mask that swaps them.
+ */
+static inline void
+exchange(uint16_t *a, uint16_t *b)
+{
+	uint16_t	mask, d;
+
+	mask = (uint16_t)(((uint32_t)*b - *a) >> 16);
+	d = (*a ^ *b) & mask;
+	*a ^= d;
+	*b ^= d;
+}
+
+
+/*
+ * median_update replaces the oldest sample in the window with x and
+ * returns the median of the window. A copy of the window is sorted by
+ * a fixed network of compare-exchanges, odd-even transposition: on
+ * each of FILTER_MEDIAN passes, every other neighbouring pair is put in
+ * order, starting from the first pair on even passes and the second
+ * on odd ones. The same exchanges are made whatever the samples are,
+ * and none of them branches, so every sample takes the same time.
+ */
+uint16_t
+median_update(struct median *m, uint16_t x)
+{
+	uint16_t	v[FILTER_MEDIAN];
+	uint8_t		i, j;
+
+	m->window[m->oldest] = x;
+	if (++m->oldest == FILTER_MEDIAN) {
+		m->oldest = 0;
+	}
+
+	for (i = 0; i < FILTER_MEDIAN; i++) {
+		v[i] = m->window[i];
+	}
+
+	for (i = 0; i < FILTER_MEDIAN; i++) {
+		for (j = i & 1; j < (FILTER_MEDIAN - 1); j += 2) {
+			exchange(&v[j], &v[j + 1]);
+		}
+	}
+
+	return v[FILTER_MEDIAN / 2];
+}
+
+
+/*
+ * iir_update runs x through the low-pass filter and returns the new
+ * output, rounded to the nearest integer.
+ */
+uint16_t
+iir_update(struct iir *f, uint16_t x)
+{
+	int32_t	in = (int32_t)x << FILTER_FRAC;
+
+	f->state += (in - f->state) >> f->shift;
+	return (uint16_t)((f->state + (1 << (FILTER_FRAC - 1))) >>
+	    FILTER_FRAC);
+}
+
+
+/*
+ * filter_update runs x through both stages and returns the filtered
+ * value.
+ */
+uint16_t
+filter_update(struct filter *f, uint16_t x)
+{
+	uint8_t	i;
+
+	if (!f->primed) {
+		for (i = 0; i < FILTER_MEDIAN; i++) {
+			f->median.window[i] = x;
+		}
+		f->median.oldest = 0;
+		f->iir.state = (int32_t)x << FILTER_FRAC;
+		f->primed = true;
+	}
+
+	return iir_update(&f->iir, median_update(&f->median, x));
+}
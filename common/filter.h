@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * filter smooths a stream of sensor samples in two stages. A sliding
+ * median over the last few samples throws out outliers, and a one-pole
+ * low-pass filter then takes out the jitter that is left. Both stages
+ * take the same time for every sample and use only integer arithmetic,
+ * so they can be run from an interrupt as each sample arrives.
+ */
+
+
+#ifndef __FILTER_H
+#define __FILTER_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * FILTER_MEDIAN is the width of the median window. It must be odd, and
+ * is kept small: each sample sorts a copy of the window with
+ * FILTER_MEDIAN passes of compare-exchanges, so the cost grows with the
+ * square of the width: 10 exchanges at the default of 5, but 105 at 15.
+ */
+#ifndef FILTER_MEDIAN
+#define FILTER_MEDIAN	5
+#endif
+
+#if (FILTER_MEDIAN & 1) == 0 || FILTER_MEDIAN > 15
+#error "FILTER_MEDIAN must be odd and no larger than 15."
+#endif
+
+
+/*
+ * FILTER_FRAC is the number of fractional bits kept in the low-pass
+ * filter's state, which stops small steps from being lost to rounding.
+ */
+#define FILTER_FRAC	8
+
+
+/*
+ * median holds the window in arrival order, so the oldest sample can
+ * be replaced; it is sorted afresh for each sample.
+ */
+struct median {
+	uint16_t	window[FILTER_MEDIAN];
+	uint8_t		oldest;
+};
+
+
+/*
+ * iir is a one-pole low-pass filter, y += (x - y) / 2^shift, with the
+ * output kept in fixed point. Each step moves the output 1/2^shift of
+ * the way towards the input; a shift of 3 settles to within 1% in
+ * about 35 samples.
+ */
+struct iir {
+	int32_t		state;
+	uint8_t		shift;
+};
+
+
+/*
+ * A filter runs a sample through the median and then the low-pass
+ * filter. Until the first sample arrives, primed is false; that sample
+ * is used to fill both stages, so the output starts at the input rather
+ * than working its way up from zero.
+ */
+struct filter {
+	struct median	median;
+	struct iir	iir;
+	bool		primed;
+};
+
+
+void		filter_init(struct filter *f, uint8_t shift);
+uint16_t	filter_update(struct filter *f, uint16_t x);
+uint16_t	median_update(struct median *m, uint16_t x);
+uint16_t	iir_update(struct iir *f, uint16_t x);
+
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <avr/pgmspace.h>
+
+#include <stdbool.h>
+
+#include "fmt.h"
+#include "serial.h"
+
+
+/*
+ * powers holds the place value of each decimal digit of a 32-bit
+ * number, from the most significant down.
+ */
+#define NPOWERS	10
+static const uint32_t	powers[NPOWERS] PROGMEM = {
+	1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+	10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+
+/*
+ * write_decimal does the work for all of the decimal writers. point is
+ * the number of digits after the decimal point; enough leading zeros
+ * are written that there is always a digit in front of it.
+ */
+static void
+write_decimal(uint32_t n, bool negative, uint8_t width, uint8_t point)
+{
+	uint8_t		i, len;
+	uint32_t	place;
+	char		digit;
+
+	/* Find the first digit that needs to be written. */
+	for (i = 0; i < (NPOWERS - 1); i++) {
+		if (n >= pgm_read_dword(&powers[i])) {
+			break;
+		}
+	}
+
+	if ((NPOWERS - i) <= point) {
+		i = NPOWERS - (point + 1);
+	}
+
+	len = NPOWERS - i;
+	if (point > 0) {
+		len++;
+	}
+	if (negative) {
+		len++;
+	}
+
+	while (width > len) {
+		serial_write(' ');
+		width--;
+	}
+
+	if (negative) {
+		serial_write('-');
+	}
+
+	for (; i < NPOWERS; i++) {
+		if ((NPOWERS - i) == point) {
+			serial_write('.');
+		}
+
+		place = pgm_read_dword(&powers[i]);
+		digit = '0';
+		while (n >= place) {
+			n -= place;
+			digit++;
+		}
+		serial_write(digit);
+	}
+}
+
+
+void
+write_uint(uint32_t n, uint8_t width)
+{
+	write_decimal(n, false, width, 0);
+}
+
+
+void
+write_int(int32_t n, uint8_t width)
+{
+	if (n < 0) {
+		write_decimal(-(uint32_t)n, true, width, 0);
+	}
+	else {
+		write_decimal((uint32_t)n, false, width, 0);
+	}
+}
+
+
+void
+write_fixed(int32_t n, uint8_t width, uint8_t decimals)
+{
+	if (decimals > (NPOWERS - 1)) {
+		decimals = NPOWERS - 1;
+	}
+
+	if (n < 0) {
+		write_decimal(-(uint32_t)n, true, width, decimals);
+	}
+	else {
+		write_decimal((uint32_t)n, false, width, decimals);
+	}
+}
+
+
+void
+write_hex(uint16_t n, uint8_t digits)
+{
+	uint8_t	nibble;
+
+	if (digits > 4) {
+		digits = 4;
+	}
+
+	while (digits > 0) {
+		digits--;
+		nibble = (n >> (digits * 4)) & 0x0F;
+		serial_write(nibble < 10 ? '0' + nibble : 'A' + (nibble - 10));
+	}
+}
+
+
+void
+write_string_P(const char *s)
+{
+	char	c;
+
+	while ((c = pgm_read_byte(s++)) != 0) {
+		serial_write(c);
+	}
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * fmt renders numbers straight into the serial transmit buffer. Each
+ * digit is produced by repeated subtraction of a power of ten, so there
+ * is no division and no intermediate buffer, and none of the weight of
+ * the printf family.
+ */
+
+
+#ifndef __FMT_H
+#define __FMT_H
+
+
+#include <stdint.h>
+
+
+/*
+ * The width arguments give the minimum number of characters to write;
+ * shorter numbers are padded on the left with spaces, as with "%5u".
+ * A width of zero writes just the number.
+ *
+ * write_fixed writes a fixed-point number holding decimals digits after
+ * the decimal point, so write_fixed(1234, 0, 1) writes "123.4". At most
+ * nine decimals are supported.
+ *
+ * write_hex writes the low digits nibbles of n, padded with zeros; at
+ * most four digits are supported.
+ *
+ * write_string_P writes a string stored in flash, e.g. with PSTR.
+ */
+void	write_uint(uint32_t n, uint8_t width);
+void	write_int(int32_t n, uint8_t width);
+void	write_fixed(int32_t n, uint8_t width, uint8_t decimals);
+void	write_hex(uint16_t n, uint8_t digits);
+void	write_string_P(const char *s);
+
+
+#endif
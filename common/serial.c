@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "serial.h"
+
+
+#define TX_MASK		(SERIAL_TX_SIZE - 1)
+#define RX_MASK		(SERIAL_RX_SIZE - 1)
+
+
+/*
+ * The transmit ring buffer. The main program is the only producer: it
+ * stores a byte at tx_head and then advances tx_head. The UDRE
+ * interrupt is the only consumer: it sends the byte at tx_tail and then
+ * advances tx_tail. The buffer is empty when the two are equal; one
+ * slot is always left unused so that a full buffer can be told apart
+ * from an empty one.
+ */
+static volatile char	tx_buf[SERIAL_TX_SIZE];
+static volatile uint8_t	tx_head = 0;
+static volatile uint8_t	tx_tail = 0;
+
+static uint8_t		tx_policy = SERIAL_TX_POLICY;
+
+static volatile uint32_t	tx_sent = 0;
+static volatile uint32_t	tx_dropped = 0;
+
+
+/*
+ * The receive ring buffer works the same way in the other direction:
+ * the RX interrupt is the only producer, and the main program is the
+ * only consumer.
+ */
+static volatile char	rx_buf[SERIAL_RX_SIZE];
+static volatile uint8_t	rx_head = 0;
+static volatile uint8_t	rx_tail = 0;
+
+static volatile uint32_t	rx_received = 0;
+static volatile uint16_t	rx_overruns = 0;
+static volatile uint16_t	rx_frame_errors = 0;
+
+
+/*
+ * init_UART brings up the serial port.
+ */
+void
+init_UART(void)
+{
+	/*
+	 * The UBRR register is a UART baud rate register. We're using
+	 * UART 0. It's a 16-bit register, and we need to set the high
+	 * and low bytes to the value worked out for BAUD in serial.h.
+	 */
+	UBRR0H = (uint8_t)(SERIAL_UBRR >> 8);
+	UBRR0L = (uint8_t)SERIAL_UBRR;
+
+	/*
+	 * UART control status registers (or UCSR0 for UART 0) control
+	 * the UART's operation. There are three such registers, labeled
+	 * A, B, and C.
+	 */
+
+	/*
+	 * In UCSR0A, we enable 2x transmission speed only if it gets
+	 * closer to the requested baud rate.
+	 */
+#if SERIAL_USE_2X
+	UCSR0A |= (1 << U2X0);
+#else
+	UCSR0A &= ~(1 << U2X0);
+#endif
+
+	/*
+	 * Enable the transmitter (transmit enable 0) and receiver
+	 * (receive enable 0), along with the receive complete
+	 * interrupt. The data register empty interrupt is only enabled
+	 * while there is something in the transmit buffer; otherwise,
+	 * it would fire continuously.
+	 */
+	UCSR0B = ((1 << TXEN0)|(1 << RXEN0)|(1 << RXCIE0));
+
+	/*
+	 * Now, we set the framing to the most common format: 8 data bits,
+	 * one stop bit.
+	 */
+	UCSR0C = ((1 << UCSZ01)|(1 << UCSZ00));
+}
+
+
+/*
+ * serial_set_policy selects what serial_write does with a full
+ * transmit buffer.
+ */
+void
+serial_set_policy(uint8_t policy)
+{
+	tx_policy = policy;
+}
+
+
+/*
+ * tx_drain_one hands the oldest queued byte to the UART by hand. It is
+ * used when a blocking write happens with interrupts disabled, in which
+ * case the UDRE interrupt can't make room in the buffer for us.
+ */
+static void
+tx_drain_one(void)
+{
+	loop_until_bit_is_set(UCSR0A, UDRE0);
+	UDR0 = tx_buf[tx_tail];
+	tx_tail = (tx_tail + 1) & TX_MASK;
+	tx_sent++;
+}
+
+
+/*
+ * serial_write queues a single byte for transmission, returning false
+ * if it was dropped. Only the SERIAL_BLOCK policy will ever wait; the
+ * other policies always return immediately. It must only be called
+ * from the main program, as the buffer has a single producer.
+ */
+bool
+serial_write(char c)
+{
+	uint8_t	next = (tx_head + 1) & TX_MASK;
+	uint8_t	saved_SREG;
+
+	while (next == tx_tail) {
+		if (tx_policy == SERIAL_DROP) {
+			tx_dropped++;
+			return false;
+		}
+		else if (tx_policy == SERIAL_OVERWRITE) {
+			/*
+			 * The UDRE interrupt also moves the tail, so it
+			 * has to be kept out while the oldest byte is
+			 * thrown away.
+			 */
+			saved_SREG = SREG;
+			cli();
+			if (next == tx_tail) {
+				tx_tail = (tx_tail + 1) & TX_MASK;
+				tx_dropped++;
+			}
+			SREG = saved_SREG;
+		}
+		else if (bit_is_clear(SREG, SREG_I)) {
+			tx_drain_one();
+		}
+	}
+
+	tx_buf[tx_head] = c;
+	tx_head = next;
+
+	/* Make sure the UDRE interrupt will pick up the new byte. */
+	UCSR0B |= _BV(UDRIE0);
+	return true;
+}
+
+
+/*
+ * write_string writes the string to the serial port.
+ */
+void
+write_string(const char *s)
+{
+	while (*s != 0) {
+		serial_write(*s++);
+	}
+}
+
+
+/*
+ * newline sends a CR-LF over the serial port.
+ */
+void
+newline(void)
+{
+	serial_write('\r');
+	serial_write('\n');
+}
+
+
+/*
+ * serial_flush waits until every queued byte has been handed to the
+ * UART.
+ */
+void
+serial_flush(void)
+{
+	while (tx_head != tx_tail) {
+		if (bit_is_clear(SREG, SREG_I)) {
+			tx_drain_one();
+		}
+	}
+}
+
+
+/*
+ * serial_available returns the number of received bytes waiting to be
+ * read.
+ */
+uint8_t
+serial_available(void)
+{
+	return (rx_head - rx_tail) & RX_MASK;
+}
+
+
+/*
+ * serial_try_read stores the next received byte in c and returns true,
+ * or returns false straight away if nothing has been received.
+ */
+bool
+serial_try_read(char *c)
+{
+	if (rx_head == rx_tail) {
+		return false;
+	}
+
+	*c = rx_buf[rx_tail];
+	rx_tail = (rx_tail + 1) & RX_MASK;
+	return true;
+}
+
+
+/*
+ * serial_read blocks until a character is available from the UART,
+ * returning that character when it is received.
+ */
+char
+serial_read(void)
+{
+	char	c;
+
+	while (!serial_try_read(&c)) {}
+	return c;
+}
+
+
+/*
+ * serial_read_line moves whatever has been received into line, and
+ * returns true once a full line has been assembled. Lines may end in
+ * CR, LF, or CR-LF; empty lines are skipped. The next call after a
+ * line is returned starts a new line, so the caller must be done with
+ * it by then. It never waits for input.
+ */
+bool
+serial_read_line(struct serial_line *line)
+{
+	char	c;
+
+	if (line->complete) {
+		line->len = 0;
+		line->truncated = false;
+		line->complete = false;
+	}
+
+	while (serial_try_read(&c)) {
+		if (c == '\r' || c == '\n') {
+			if (line->len == 0) {
+				continue;
+			}
+
+			line->buf[line->len] = 0;
+			line->complete = true;
+			return true;
+		}
+
+		if (line->len < (SERIAL_LINE_MAX - 1)) {
+			line->buf[line->len++] = c;
+		}
+		else {
+			line->truncated = true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * serial_get_stats copies out the driver's counters. The counters are
+ * updated from the UART interrupts, so they are kept out while the
+ * counters are copied.
+ */
+void
+serial_get_stats(struct serial_stats *stats)
+{
+	uint8_t	saved_SREG;
+
+	saved_SREG = SREG;
+	cli();
+	stats->sent = tx_sent;
+	stats->dropped = tx_dropped;
+	stats->received = rx_received;
+	stats->overruns = rx_overruns;
+	stats->frame_errors = rx_frame_errors;
+	SREG = saved_SREG;
+}
+
+
+/*
+ * The UDRE interrupt fires whenever the UART is ready for another byte
+ * and moves the next byte out of the transmit buffer. Once the buffer
+ * is empty, it switches itself off until serial_write queues more.
+ */
+ISR(USART_UDRE_vect)
+{
+	if (tx_head == tx_tail) {
+		UCSR0B &= ~_BV(UDRIE0);
+		return;
+	}
+
+	UDR0 = tx_buf[tx_tail];
+	tx_tail = (tx_tail + 1) & TX_MASK;
+	tx_sent++;
+
+	if (tx_head == tx_tail) {
+		UCSR0B &= ~_BV(UDRIE0);
+	}
+}
+
+
+/*
+ * The RX interrupt fires whenever a byte has been received and moves
+ * it into the receive buffer. The error flags in UCSR0A describe the
+ * byte in UDR0, so they have to be read before it.
+ */
+ISR(USART_RX_vect)
+{
+	uint8_t	status = UCSR0A;
+	char	c = UDR0;
+	uint8_t	next;
+
+	if (status & _BV(FE0)) {
+		rx_frame_errors++;
+		return;
+	}
+
+	/*
+	 * A data overrun means the UART had to throw away at least one
+	 * byte before this one; this byte itself is still good.
+	 */
+	if (status & _BV(DOR0)) {
+		rx_overruns++;
+	}
+
+	next = (rx_head + 1) & RX_MASK;
+	if (next == rx_tail) {
+		rx_overruns++;
+		return;
+	}
+
+	rx_buf[rx_head] = c;
+	rx_head = next;
+	rx_received++;
+}
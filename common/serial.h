@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * This is the interrupt-driven serial driver shared by the projects.
+ * Bytes written to the serial port are queued in a ring buffer and
+ * handed to the UART by the data register empty interrupt, so the
+ * caller never has to wait on the wire. Received bytes are likewise
+ * collected by the receive complete interrupt into a second ring
+ * buffer, so nothing is lost while the main program is busy.
+ */
+
+
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * The baud rate is set at build time with BAUD. The UART divides the
+ * system clock by 16 (or by 8 in double-speed mode) and then by UBRR+1,
+ * so most rates can only be approximated. Both modes are worked out
+ * here, and whichever lands closer to BAUD is used; normal speed wins a
+ * tie, as it samples each bit more times. At 16 MHz, this gives:
+ *
+ *	BAUD	   mode	 UBRR	error
+ *	9600	   1x	 103	0.2%
+ *	115200	   2x	 16	2.1%
+ *	250000	   1x	 3	0.0%
+ *	500000	   1x	 1	0.0%
+ *	1000000	   1x	 0	0.0%
+ *	2000000	   2x	 0	0.0%
+ *
+ * SERIAL_BAUD_TOL is the largest error, in tenths of a percent, that
+ * will be accepted; a build for a rate outside of it fails instead of
+ * producing garbled output. The receiver tolerates a total mismatch of
+ * roughly 4.5%, and the default leaves the rest of that for the other
+ * end of the line.
+ */
+#if !defined(F_CPU) || !defined(BAUD)
+#error "F_CPU and BAUD must be defined to use the serial driver."
+#endif
+
+#ifndef SERIAL_BAUD_TOL
+#define SERIAL_BAUD_TOL	25
+#endif
+
+#if (BAUD) > ((F_CPU) / 8)
+#error "BAUD is faster than the UART can run at this F_CPU."
+#endif
+
+#define SERIAL_UBRR_1X	(((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+#define SERIAL_UBRR_2X	(((F_CPU) + 4UL * (BAUD)) / (8UL * (BAUD)) - 1UL)
+#define SERIAL_BAUD_1X	((F_CPU) / (16UL * (SERIAL_UBRR_1X + 1UL)))
+#define SERIAL_BAUD_2X	((F_CPU) / (8UL * (SERIAL_UBRR_2X + 1UL)))
+#define SERIAL_ERROR(actual)	(((actual) > (BAUD) ?			\
+				  (actual) - (BAUD) : (BAUD) - (actual))	\
+				 * 1000UL / (BAUD))
+
+#if SERIAL_ERROR(SERIAL_BAUD_2X) < SERIAL_ERROR(SERIAL_BAUD_1X)
+#define SERIAL_USE_2X		1
+#define SERIAL_UBRR		SERIAL_UBRR_2X
+#define SERIAL_BAUD_ACTUAL	SERIAL_BAUD_2X
+#else
+#define SERIAL_USE_2X		0
+#define SERIAL_UBRR		SERIAL_UBRR_1X
+#define SERIAL_BAUD_ACTUAL	SERIAL_BAUD_1X
+#endif
+
+#if SERIAL_ERROR(SERIAL_BAUD_ACTUAL) > SERIAL_BAUD_TOL
+#error "The baud rate error for BAUD is larger than SERIAL_BAUD_TOL."
+#endif
+
+
+/*
+ * SERIAL_TX_SIZE is the size of the transmit ring buffer. It must be a
+ * power of two so that the indices can wrap with a mask, and no larger
+ * than 256 so that they fit in a single byte.
+ */
+#ifndef SERIAL_TX_SIZE
+#define SERIAL_TX_SIZE	64
+#endif
+
+#if (SERIAL_TX_SIZE & (SERIAL_TX_SIZE - 1)) != 0 || SERIAL_TX_SIZE > 256
+#error "SERIAL_TX_SIZE must be a power of two no larger than 256."
+#endif
+
+
+/*
+ * SERIAL_RX_SIZE is the size of the receive ring buffer; it has the
+ * same restrictions as the transmit buffer.
+ */
+#ifndef SERIAL_RX_SIZE
+#define SERIAL_RX_SIZE	64
+#endif
+
+#if (SERIAL_RX_SIZE & (SERIAL_RX_SIZE - 1)) != 0 || SERIAL_RX_SIZE > 256
+#error "SERIAL_RX_SIZE must be a power of two no larger than 256."
+#endif
+
+
+/*
+ * SERIAL_LINE_MAX is the longest line serial_read_line will assemble,
+ * including the terminating NUL.
+ */
+#ifndef SERIAL_LINE_MAX
+#define SERIAL_LINE_MAX	32
+#endif
+
+
+/*
+ * The overflow policy decides what happens when a byte is written
+ * while the transmit buffer is full:
+ *
+ *   SERIAL_DROP discards the new byte.
+ *   SERIAL_BLOCK waits until there is room for it.
+ *   SERIAL_OVERWRITE discards the oldest queued byte to make room.
+ *
+ * SERIAL_TX_POLICY sets the policy in effect at boot; it may be changed
+ * at run time with serial_set_policy.
+ */
+#define SERIAL_DROP		0
+#define SERIAL_BLOCK		1
+#define SERIAL_OVERWRITE	2
+
+#ifndef SERIAL_TX_POLICY
+#define SERIAL_TX_POLICY	SERIAL_BLOCK
+#endif
+
+
+/*
+ * serial_stats collects the driver's counters. sent counts the bytes
+ * that have been handed to the UART, and dropped counts the bytes that
+ * were discarded because the transmit buffer was full. received counts
+ * the bytes placed in the receive buffer. overruns counts the bytes
+ * that were lost on the way in, either because the UART reported a
+ * data overrun or because the receive buffer was full, and
+ * frame_errors counts the bytes thrown away for a bad stop bit.
+ */
+struct serial_stats {
+	uint32_t	sent;
+	uint32_t	dropped;
+	uint32_t	received;
+	uint16_t	overruns;
+	uint16_t	frame_errors;
+};
+
+
+/*
+ * serial_line holds a line being assembled by serial_read_line. It
+ * must be zeroed before its first use. Once a line is complete, buf
+ * holds it as a NUL-terminated string; truncated is set if the line was
+ * too long to fit and its tail was dropped.
+ */
+struct serial_line {
+	char	buf[SERIAL_LINE_MAX];
+	uint8_t	len;
+	bool	truncated;
+	bool	complete;
+};
+
+
+void	init_UART(void);
+void	serial_set_policy(uint8_t policy);
+bool	serial_write(char c);
+void	write_string(const char *s);
+void	newline(void);
+void	serial_flush(void);
+uint8_t	serial_available(void);
+bool	serial_try_read(char *c);
+char	serial_read(void);
+bool	serial_read_line(struct serial_line *line);
+void	serial_get_stats(struct serial_stats *stats);
+
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * snapshot passes multi-byte data between interrupts and the main
+ * program without tearing, and without the main program having to turn
+ * interrupts off to do it. An 8-bit AVR copies a 16-bit value a byte at
+ * a time, so an interrupt that lands in the middle of a copy can leave
+ * the copy half old and half new.
+ *
+ * Data going from an interrupt to the main program is guarded by a
+ * sequence count. The interrupt bumps the count before and after it
+ * writes, leaving it odd while the data is changing; the main program
+ * notes the count, copies the data, and copies it again if the count
+ * has moved in the meantime:
+ *
+ *	do {
+ *		seq = snapshot_read_begin(&snap);
+ *		copy = shared;
+ *	} while (snapshot_read_retry(&snap, seq));
+ *
+ * Data going the other way is double-buffered. The main program fills
+ * the buffer the interrupt isn't using and marks it pending; the next
+ * time the interrupt calls snapshot_take, it switches to that buffer.
+ * snapshot_publish_begin withdraws any pending buffer first, so the
+ * interrupt never switches to a buffer that is still being written.
+ * The buffer handed out may hold stale data, so it has to be filled in
+ * full each time.
+ */
+
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Keep the compiler from moving memory accesses across this point. */
+#define snapshot_barrier()	__asm__ __volatile__("" ::: "memory")
+
+
+/*
+ * snapshot is the sequence count for data written by an interrupt. It
+ * must only have one writer.
+ */
+struct snapshot {
+	volatile uint8_t	seq;
+};
+
+
+static inline void
+snapshot_write_begin(struct snapshot *snap)
+{
+	snap->seq++;
+	snapshot_barrier();
+}
+
+
+static inline void
+snapshot_write_end(struct snapshot *snap)
+{
+	snapshot_barrier();
+	snap->seq++;
+}
+
+
+static inline uint8_t
+snapshot_read_begin(const struct snapshot *snap)
+{
+	uint8_t	seq;
+
+	while ((seq = snap->seq) & 1) {}
+	snapshot_barrier();
+	return seq;
+}
+
+
+static inline bool
+snapshot_read_retry(const struct snapshot *snap, uint8_t seq)
+{
+	snapshot_barrier();
+	return snap->seq != seq;
+}
+
+
+/*
+ * publish tracks a pair of buffers written by the main program and read
+ * by an interrupt: live is the index of the buffer the interrupt is
+ * using, and pending is set when the other one holds newer data.
+ */
+struct publish {
+	volatile uint8_t	live;
+	volatile bool		pending;
+};
+
+
+/*
+ * snapshot_publish_begin returns the index of the buffer the main
+ * program may now fill. The interrupt won't switch to it until
+ * snapshot_publish_end is called.
+ */
+static inline uint8_t
+snapshot_publish_begin(struct publish *pub)
+{
+	pub->pending = false;
+	snapshot_barrier();
+	return pub->live ^ 1;
+}
+
+
+static inline void
+snapshot_publish_end(struct publish *pub)
+{
+	snapshot_barrier();
+	pub->pending = true;
+}
+
+
+/*
+ * snapshot_take is called by the interrupt, and returns the index of
+ * the buffer to read, switching to the newer one if it is pending.
+ */
+static inline uint8_t
+snapshot_take(struct publish *pub)
+{
+	if (pub->pending) {
+		pub->live ^= 1;
+		pub->pending = false;
+	}
+
+	return pub->live;
+}
+
+
+#endif
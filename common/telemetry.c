@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <util/crc16.h>
+
+#include "serial.h"
+#include "telemetry.h"
+
+
+static uint8_t	sequence = 0;
+
+
+/*
+ * cobs_write COBS-encodes buf onto the serial port, followed by the
+ * zero that ends the frame. Each run of non-zero bytes is sent after a
+ * code byte giving its length plus one; the zero that ends the run is
+ * implied by the code and isn't sent. A run that reaches 254 bytes
+ * without a zero is cut off with a code of 0xFF, which implies no zero.
+ */
+static void
+cobs_write(const uint8_t *buf, uint8_t len)
+{
+	uint8_t	start = 0;
+	uint8_t	end;
+
+	while (1) {
+		end = start;
+		while ((end < len) && (buf[end] != 0) && ((end - start) < 254)) {
+			end++;
+		}
+
+		serial_write((char)(end - start + 1));
+		while (start < end) {
+			serial_write((char)buf[start++]);
+		}
+
+		if (end == len) {
+			break;
+		}
+
+		/* Step over the zero that ended the run, if there was one. */
+		if (buf[end] == 0) {
+			start = end + 1;
+		}
+	}
+
+	serial_write(0);
+}
+
+
+/*
+ * telemetry_send builds a frame around the payload and queues it for
+ * transmission. Payloads longer than TELEMETRY_MAX_PAYLOAD are cut
+ * short.
+ */
+void
+telemetry_send(uint8_t type, uint16_t stamp, const uint8_t *payload,
+    uint8_t len)
+{
+	uint8_t		frame[TELEMETRY_MAX_FRAME];
+	uint8_t		i, n = 0;
+	uint16_t	crc = 0xFFFF;
+
+	if (len > TELEMETRY_MAX_PAYLOAD) {
+		len = TELEMETRY_MAX_PAYLOAD;
+	}
+
+	frame[n++] = type;
+	frame[n++] = sequence++;
+	frame[n++] = (uint8_t)stamp;
+	frame[n++] = (uint8_t)(stamp >> 8);
+	for (i = 0; i < len; i++) {
+		frame[n++] = payload[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		crc = _crc_ccitt_update(crc, frame[i]);
+	}
+	frame[n++] = (uint8_t)crc;
+	frame[n++] = (uint8_t)(crc >> 8);
+
+	cobs_write(frame, n);
+}
+
+
+/*
+ * cobs_decode decodes a COBS frame, without its trailing zero, in place,
+ * returning the decoded length, or zero if the frame is malformed. The
+ * decoded frame is always shorter than the encoded one, so nothing is
+ * overwritten before it has been read.
+ */
+static uint8_t
+cobs_decode(uint8_t *buf, uint8_t len)
+{
+	uint8_t	i = 0, n = 0;
+	uint8_t	code, j;
+
+	while (i < len) {
+		code = buf[i++];
+		if (((uint16_t)i + code - 1) > len) {
+			return 0;
+		}
+
+		for (j = 1; j < code; j++) {
+			buf[n++] = buf[i++];
+		}
+
+		if (code != 0xFF && i < len) {
+			buf[n++] = 0;
+		}
+	}
+
+	return n;
+}
+
+
+/*
+ * telemetry_decode checks the frame collected in rx and unpacks it into
+ * frame, returning false if it is damaged.
+ */
+static bool
+telemetry_decode(struct telemetry_rx *rx, struct telemetry_frame *frame)
+{
+	uint8_t		i, n;
+	uint16_t	crc = 0xFFFF;
+
+	if (rx->overflow) {
+		return false;
+	}
+
+	n = cobs_decode(rx->buf, rx->len);
+	if (n < (TELEMETRY_HEADER + TELEMETRY_CRC)) {
+		return false;
+	}
+
+	n -= TELEMETRY_CRC;
+	for (i = 0; i < n; i++) {
+		crc = _crc_ccitt_update(crc, rx->buf[i]);
+	}
+
+	if (rx->buf[n] != (uint8_t)crc ||
+	    rx->buf[n + 1] != (uint8_t)(crc >> 8)) {
+		return false;
+	}
+
+	frame->type = rx->buf[0];
+	frame->seq = rx->buf[1];
+	frame->stamp = rx->buf[2] | ((uint16_t)rx->buf[3] << 8);
+	frame->len = n - TELEMETRY_HEADER;
+	for (i = 0; i < frame->len; i++) {
+		frame->payload[i] = rx->buf[TELEMETRY_HEADER + i];
+	}
+
+	return true;
+}
+
+
+/*
+ * telemetry_receive moves whatever has been received into rx, and
+ * returns true once a good frame has been unpacked into frame. Damaged
+ * frames are counted and dropped. Like serial_read_line, it never
+ * waits for input.
+ */
+bool
+telemetry_receive(struct telemetry_rx *rx, struct telemetry_frame *frame)
+{
+	char	c;
+	bool	good;
+
+	while (serial_try_read(&c)) {
+		if (c != 0) {
+			if (rx->len < sizeof(rx->buf)) {
+				rx->buf[rx->len++] = (uint8_t)c;
+			}
+			else {
+				rx->overflow = true;
+			}
+			continue;
+		}
+
+		/* A zero ends the frame; stray zeros are skipped. */
+		if (rx->len == 0 && !rx->overflow) {
+			continue;
+		}
+
+		good = telemetry_decode(rx, frame);
+		rx->len = 0;
+		rx->overflow = false;
+		if (good) {
+			return true;
+		}
+		rx->bad++;
+	}
+
+	return false;
+}
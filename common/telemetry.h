@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * telemetry defines the binary framing used to stream sensor readings
+ * to a host. It carries the same information as the text reports in a
+ * fraction of the bytes. This header is also used by the host-side
+ * decoder in tools/, so it must not depend on anything AVR-specific.
+ *
+ * A frame is laid out as follows, with multi-byte fields stored
+ * little-endian:
+ *
+ *	offset	size	field
+ *	0	1	message type
+ *	1	1	sequence number, incremented for every frame sent
+ *	2	2	timestamp
+ *	4	n	payload, up to TELEMETRY_MAX_PAYLOAD bytes
+ *	4+n	2	CRC-16 of everything before it
+ *
+ * The CRC is the CCITT polynomial in its bit-reversed form (0x8408),
+ * starting from 0xFFFF with no final inversion; this is what avr-libc's
+ * _crc_ccitt_update computes. The whole frame is then COBS-encoded so
+ * that it contains no zero bytes, and a zero byte is sent after it to
+ * mark the end. A receiver that joins mid-stream or sees a damaged
+ * frame only has to wait for the next zero to get back in step.
+ *
+ * Commands sent to a project use the same framing in the other
+ * direction.
+ */
+
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define TELEMETRY_HEADER	4
+#define TELEMETRY_CRC		2
+#define TELEMETRY_MAX_PAYLOAD	32
+#define TELEMETRY_MAX_FRAME	(TELEMETRY_HEADER + TELEMETRY_MAX_PAYLOAD + \
+				 TELEMETRY_CRC)
+
+
+/*
+ * Message types and their payloads.
+ *
+ * TELEMETRY_URS is a URS reading: a 16-bit reading count followed by
+ * the 16-bit raw reading, the 16-bit filtered reading, the distance in
+ * millimetres and the measured supply in millivolts, all 16-bit. The
+ * timestamp is the low 16 bits of millis() when the reading was
+ * taken.
+ *
+ * TELEMETRY_STROBE is the result of a cycle of the IR proximity
+ * array, in which each channel was strobed once. It holds a byte with
+ * one bit set for each channel that detected an object, the 16-bit
+ * count of cycles so far, the number of channels n, then n bytes
+ * giving the time each channel's receiver output was low, and then n
+ * bytes giving the time from the start of each channel's burst to its
+ * receiver's first response, 255 if there was none. Both are in carrier
+ * cycles. The timestamp is the low 16 bits of millis() when the cycle
+ * finished.
+ */
+#define TELEMETRY_URS		0x01
+#define TELEMETRY_URS_SIZE	10
+
+#define TELEMETRY_STROBE	0x02
+#define TELEMETRY_STROBE_SIZE(n)	(4 + 2 * (n))
+
+
+/*
+ * Servo commands, sent by the host to 06_pwm, and their replies. The
+ * timestamp of a command is ignored.
+ *
+ * TELEMETRY_SERVO_SET sets a batch of servos at once. It holds a 16-bit
+ * mask with one bit set for each servo being set, followed by a 16-bit
+ * pulse width in microseconds for each of those servos, lowest numbered
+ * first. Every servo in the batch takes its new setting on the same
+ * frame.
+ *
+ * TELEMETRY_SERVO_MOVE has the same layout, but moves the servos to
+ * their new settings together under their motion profiles.
+ *
+ * TELEMETRY_SERVO_ACK answers each command. It holds the sequence number
+ * of the command, a status byte, and the 16-bit number of the servo
+ * frame on which the command took effect; the timestamp is the frame
+ * number as well. A command that was refused is answered straight away,
+ * with the current frame number.
+ */
+#define TELEMETRY_SERVO_SET	0x10
+#define TELEMETRY_SERVO_MOVE	0x11
+#define TELEMETRY_SERVO_SIZE(n)	(2 + 2 * (n))
+
+#define TELEMETRY_SERVO_ACK	0x12
+#define TELEMETRY_SERVO_ACK_SIZE	4
+
+#define TELEMETRY_ACK_OK	0x00
+#define TELEMETRY_ACK_BAD	0x01	/* The payload didn't fit the type. */
+#define TELEMETRY_ACK_UNKNOWN	0x02	/* The type isn't a command. */
+
+
+/*
+ * telemetry_frame holds a frame received by telemetry_receive.
+ */
+struct telemetry_frame {
+	uint8_t		type;
+	uint8_t		seq;
+	uint16_t	stamp;
+	uint8_t		len;
+	uint8_t		payload[TELEMETRY_MAX_PAYLOAD];
+};
+
+
+/*
+ * telemetry_rx holds a frame being assembled by telemetry_receive. It
+ * must be zeroed before its first use. bad counts the frames that were
+ * thrown away for being damaged or too long.
+ */
+struct telemetry_rx {
+	uint8_t		buf[TELEMETRY_MAX_FRAME + 1];
+	uint8_t		len;
+	bool		overflow;
+	uint16_t	bad;
+};
+
+
+void	telemetry_send(uint8_t type, uint16_t stamp, const uint8_t *payload,
+	    uint8_t len);
+bool	telemetry_receive(struct telemetry_rx *rx,
+	    struct telemetry_frame *frame);
+
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "wheel.h"
+
+
+#define SLOT_MASK	(WHEEL_SLOTS - 1)
+
+/*
+ * WHEEL_MAX_SKIP is the furthest ahead the compare match is ever set,
+ * in ticks, which keeps it within half of Timer1's range of the count.
+ * With nothing in the wheel, it wakes up this often just to keep track
+ * of the time.
+ */
+#define WHEEL_MAX_SKIP	(0x7FFF / WHEEL_COUNTS)
+
+/*
+ * WHEEL_MIN_LEAD is the fewest Timer1 counts the compare match can be
+ * set ahead of the count and still be sure of being caught.
+ */
+#define WHEEL_MIN_LEAD	2
+
+
+/*
+ * The wheel's time. wheel_now is the last tick that has been run, and
+ * wheel_base is the Timer1 count it ran at; wheel_next is the tick the
+ * compare match is set for. Ticks are 16 bits and wrap, which is fine
+ * as only differences between them are used.
+ */
+static struct wheel_timer	*wheel_slots[WHEEL_SLOTS];
+static volatile uint16_t	 wheel_now = 0;
+static volatile uint16_t	 wheel_next = 0;
+static volatile uint16_t	 wheel_base = 0;
+
+
+/*
+ * wheel_init starts Timer1 and the compare interrupt. The timers start
+ * running once interrupts are enabled.
+ */
+void
+wheel_init(void)
+{
+	PRR &= ~_BV(PRTIM1);
+
+	/* Timer1 runs in normal mode with a prescaler of 64. */
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11) | _BV(CS10);
+
+	wheel_base = TCNT1;
+	wheel_next = wheel_now + WHEEL_MAX_SKIP;
+	OCR1A = wheel_base + WHEEL_MAX_SKIP * WHEEL_COUNTS;
+	TIFR1 = _BV(OCF1A);
+	TIMSK1 |= _BV(OCIE1A);
+}
+
+
+/*
+ * wheel_timer_init sets up a timer to call fn with arg once it is due.
+ * It must be called before the timer is first started.
+ */
+void
+wheel_timer_init(struct wheel_timer *t, void (*fn)(void *), void *arg)
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->fn = fn;
+	t->arg = arg;
+}
+
+
+static void
+link(struct wheel_timer **head, struct wheel_timer *t)
+{
+	t->next = *head;
+	if (t->next != NULL) {
+		t->next->pprev = &t->next;
+	}
+	*head = t;
+	t->pprev = head;
+}
+
+
+static void
+unlink(struct wheel_timer *t)
+{
+	*t->pprev = t->next;
+	if (t->next != NULL) {
+		t->next->pprev = t->pprev;
+	}
+	t->pprev = NULL;
+}
+
+
+/*
+ * wheel_start starts a timer, which is first due after delay ticks and
+ * then, if period isn't zero, every period ticks after that. The first
+ * call comes between delay and delay + 1 ticks from now, as the current
+ * tick is already partly gone; a delay of 0 is taken as 1. Delays and
+ * periods must be less than 32768 ticks. A running timer is restarted.
+ */
+void
+wheel_start(struct wheel_timer *t, uint16_t delay, uint16_t period)
+{
+	uint8_t		saved_SREG;
+	uint16_t	ahead;
+
+	if (delay == 0) {
+		delay = 1;
+	}
+
+	saved_SREG = SREG;
+	cli();
+
+	if (t->pprev != NULL) {
+		unlink(t);
+	}
+
+	/*
+	 * The ticks since wheel_now are worked out from the count. The
+	 * compare match is set at least a whole tick ahead of the count,
+	 * which it will always be for a tick counted from here.
+	 */
+	ahead = (uint16_t)(TCNT1 - wheel_base) / WHEEL_COUNTS + delay + 1;
+	t->expires = wheel_now + ahead;
+	t->period = period;
+	link(&wheel_slots[t->expires & SLOT_MASK], t);
+
+	/*
+	 * Bring the compare match forward if this timer is due first. If
+	 * the match has already happened, the interrupt is about to run
+	 * and will find this timer itself.
+	 */
+	if (ahead < (uint16_t)(wheel_next - wheel_now) &&
+	    !(TIFR1 & _BV(OCF1A))) {
+		wheel_next = t->expires;
+		OCR1A = wheel_base + ahead * WHEEL_COUNTS;
+	}
+
+	SREG = saved_SREG;
+}
+
+
+/*
+ * wheel_stop stops a timer if it is running.
+ */
+void
+wheel_stop(struct wheel_timer *t)
+{
+	uint8_t	saved_SREG;
+
+	saved_SREG = SREG;
+	cli();
+	if (t->pprev != NULL) {
+		unlink(t);
+	}
+	SREG = saved_SREG;
+}
+
+
+/*
+ * wheel_running returns true if the timer is waiting to be called.
+ */
+bool
+wheel_running(struct wheel_timer *t)
+{
+	return t->pprev != NULL;
+}
+
+
+/*
+ * run_slot calls every timer due on wheel_now. The due timers are
+ * moved to a list of their own first, so that a timer restarted into
+ * the same slot isn't seen twice, and so that a timer function stopping
+ * another due timer keeps it from being called. A periodic timer is
+ * restarted before it is called, so that it can stop itself.
+ */
+static void
+run_slot(void)
+{
+	struct wheel_timer	**head = &wheel_slots[wheel_now & SLOT_MASK];
+	struct wheel_timer	 *due = NULL;
+	struct wheel_timer	 *t, *next;
+
+	for (t = *head; t != NULL; t = next) {
+		next = t->next;
+		if (t->expires == wheel_now) {
+			unlink(t);
+			link(&due, t);
+		}
+	}
+
+	while ((t = due) != NULL) {
+		unlink(t);
+		if (t->period != 0) {
+			t->expires += t->period;
+			link(&wheel_slots[t->expires & SLOT_MASK], t);
+		}
+		t->fn(t->arg);
+	}
+}
+
+
+/*
+ * next_skip returns the number of ticks to the next slot with any
+ * timers in it, up to WHEEL_MAX_SKIP. A slot may only hold timers for a
+ * later turn of the wheel, in which case the interrupt finds nothing to
+ * do there.
+ */
+static uint16_t
+next_skip(void)
+{
+	uint16_t	skip;
+
+	for (skip = 1; skip <= WHEEL_SLOTS; skip++) {
+		if (skip == WHEEL_MAX_SKIP ||
+		    wheel_slots[(wheel_now + skip) & SLOT_MASK] != NULL) {
+			return skip;
+		}
+	}
+
+	return WHEEL_MAX_SKIP;
+}
+
+
+/*
+ * The compare A interrupt runs the slot it was set for and moves the
+ * compare match on to the next slot in use. If the timer functions ran
+ * so long that the count is already at or near that slot, it carries
+ * on with that slot here rather than wait for the count to come round
+ * again. The flag is cleared as each new compare value is set, before
+ * the count is checked: with WHEEL_MIN_LEAD counts in hand, the flag
+ * can only be left over from an earlier value, and a match that comes
+ * while a slot is being run early is cleared along with the next value
+ * rather than running a slot that isn't due.
+ */
+ISR(TIMER1_COMPA_vect)
+{
+	uint16_t	skip;
+
+	while (1) {
+		wheel_base += (uint16_t)(wheel_next - wheel_now) * WHEEL_COUNTS;
+		wheel_now = wheel_next;
+		run_slot();
+
+		skip = next_skip();
+		wheel_next = wheel_now + skip;
+		OCR1A = wheel_base + skip * WHEEL_COUNTS;
+		TIFR1 = _BV(OCF1A);
+		if ((int16_t)(OCR1A - TCNT1) >= WHEEL_MIN_LEAD) {
+			break;
+		}
+	}
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * wheel runs any number of software timers from one hardware timer.
+ * Each timer calls a function once it is due, either once or every
+ * period after that. Timers are kept in a hashed wheel: a ring of
+ * WHEEL_SLOTS lists, with each timer in the list its expiry tick hashes
+ * to. Starting or stopping a timer is a link or unlink, whatever the
+ * number of timers.
+ *
+ * Timer1 runs freely with a prescaler of 64, and its compare A match is
+ * moved to the next slot that has anything in it, so ticks with nothing
+ * due don't cost an interrupt. Only compare A is used: compare B and
+ * the input capture unit are left for other work, at the wheel's 4us
+ * resolution.
+ *
+ * The timer functions run in the compare interrupt, with interrupts
+ * off, and should be short. They may start and stop timers, including
+ * their own.
+ */
+
+
+#ifndef __WHEEL_H
+#define __WHEEL_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#if !defined(F_CPU)
+#error "F_CPU must be defined to use the timer wheel."
+#endif
+
+
+/*
+ * WHEEL_TICK_US is the length of a tick, in microseconds; the timers
+ * are counted in ticks. It must be a whole number of Timer1 counts.
+ */
+#ifndef WHEEL_TICK_US
+#define WHEEL_TICK_US	1000
+#endif
+
+#define WHEEL_COUNTS	(WHEEL_TICK_US * ((F_CPU) / 1000000UL) / 64)
+
+#if ((WHEEL_TICK_US * ((F_CPU) / 1000000UL)) % 64) != 0
+#error "WHEEL_TICK_US must be a whole number of Timer1 counts."
+#endif
+
+#if WHEEL_COUNTS < 16 || WHEEL_COUNTS > 0x4000
+#error "WHEEL_TICK_US is out of range for Timer1."
+#endif
+
+/* WHEEL_TICKS converts milliseconds to ticks. */
+#define WHEEL_TICKS(ms)	((uint16_t)((ms) * 1000UL / WHEEL_TICK_US))
+
+
+/*
+ * WHEEL_SLOTS is the number of lists in the wheel. It must be a power
+ * of two. A timer due more than WHEEL_SLOTS ticks ahead still works,
+ * but its slot costs an interrupt on each turn of the wheel until then.
+ */
+#ifndef WHEEL_SLOTS
+#define WHEEL_SLOTS	32
+#endif
+
+#if (WHEEL_SLOTS & (WHEEL_SLOTS - 1)) != 0 || WHEEL_SLOTS > 128
+#error "WHEEL_SLOTS must be a power of two no larger than 128."
+#endif
+
+
+/*
+ * wheel_timer is a single timer. The caller owns it, and it must stay
+ * put while it is running. expires and period are in ticks; a period
+ * of 0 makes it a one-shot timer. The list links are only touched by
+ * the wheel.
+ */
+struct wheel_timer {
+	struct wheel_timer	 *next;
+	struct wheel_timer	**pprev;
+	uint16_t		  expires;
+	uint16_t		  period;
+	void			(*fn)(void *arg);
+	void			 *arg;
+};
+
+
+void	wheel_init(void);
+void	wheel_timer_init(struct wheel_timer *t, void (*fn)(void *), void *arg);
+void	wheel_start(struct wheel_timer *t, uint16_t delay, uint16_t period);
+void	wheel_stop(struct wheel_timer *t);
+bool	wheel_running(struct wheel_timer *t);
+
+
+#endif
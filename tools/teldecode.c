@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2015 Kyle Isom <coder@kyleisom.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * teldecode reads the binary telemetry stream described in
+ * common/telemetry.h, checks every frame, and prints the readings it
+ * carries. When the stream ends, it prints a summary of how many frames
+ * were good, damaged or lost; lost frames are found from gaps in the
+ * sequence numbers.
+ *
+ * Usage: teldecode [-q] [-b baud] [device]
+ *
+ * With a device, the serial port is put in raw mode at the given baud
+ * rate (9600 by default); otherwise, the stream is read from standard
+ * input. -q suppresses the per-frame output.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+
+struct counters {
+	unsigned long	good;
+	unsigned long	bad_crc;
+	unsigned long	bad_frame;
+	unsigned long	lost;
+};
+
+
+static volatile sig_atomic_t	done = 0;
+
+
+static void
+stop(int sig)
+{
+	(void)sig;
+	done = 1;
+}
+
+
+static uint16_t
+crc_update(uint16_t crc, uint8_t data)
+{
+	int	i;
+
+	crc ^= data;
+	for (i = 0; i < 8; i++) {
+		if (crc & 1) {
+			crc = (crc >> 1) ^ 0x8408;
+		}
+		else {
+			crc >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+
+static uint16_t
+get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+
+/*
+ * cobs_decode decodes len bytes of a COBS frame (without its trailing
+ * zero) from in to out, returning the decoded length or -1 if the frame
+ * is malformed.
+ */
+static int
+cobs_decode(const uint8_t *in, size_t len, uint8_t *out, size_t outlen)
+{
+	size_t	i = 0, n = 0;
+	uint8_t	code, j;
+
+	while (i < len) {
+		code = in[i++];
+		if (code == 0 || (i + code - 1) > len) {
+			return -1;
+		}
+
+		for (j = 1; j < code; j++) {
+			if (n == outlen) {
+				return -1;
+			}
+			out[n++] = in[i++];
+		}
+
+		if (code != 0xFF && i < len) {
+			if (n == outlen) {
+				return -1;
+			}
+			out[n++] = 0;
+		}
+	}
+
+	return (int)n;
+}
+
+
+static void
+print_frame(const uint8_t *frame, int len)
+{
+	const uint8_t	*payload = frame + TELEMETRY_HEADER;
+	int		 plen = len - TELEMETRY_HEADER - TELEMETRY_CRC;
+	int		 i;
+
+	printf("seq %3u t %5u ", frame[1], get16(frame + 2));
+	switch (frame[0]) {
+	case TELEMETRY_URS:
+		if (plen == TELEMETRY_URS_SIZE) {
+			printf("urs #%u: %u, filtered %u, %umm, Vcc %umV\n",
+			    get16(payload), get16(payload + 2),
+			    get16(payload + 4), get16(payload + 6),
+			    get16(payload + 8));
+			return;
+		}
+		break;
+	case TELEMETRY_STROBE:
+		if (plen >= 4 && plen == TELEMETRY_STROBE_SIZE(payload[3])) {
+			printf("strobe #%u: detected %02x, low",
+			    get16(payload + 1), payload[0]);
+			for (i = 0; i < payload[3]; i++) {
+				printf(" %u", payload[4 + i]);
+			}
+			printf(", latency");
+			for (i = 4 + payload[3]; i < plen; i++) {
+				if (payload[i] == 0xFF) {
+					printf(" -");
+				}
+				else {
+					printf(" %u", payload[i]);
+				}
+			}
+			printf("\n");
+			return;
+		}
+		break;
+	case TELEMETRY_SERVO_ACK:
+		if (plen == TELEMETRY_SERVO_ACK_SIZE) {
+			printf("servo ack #%u: status %u, frame %u\n",
+			    payload[0], payload[1], get16(payload + 2));
+			return;
+		}
+		break;
+	}
+
+	printf("type 0x%02x:", frame[0]);
+	for (i = 0; i < plen; i++) {
+		printf(" %02x", payload[i]);
+	}
+	printf("\n");
+}
+
+
+/*
+ * check_frame validates a decoded frame and updates the counters.
+ */
+static void
+check_frame(const uint8_t *frame, int len, bool quiet, struct counters *c)
+{
+	static bool	synced = false;
+	static uint8_t	expected = 0;
+	uint16_t	crc = 0xFFFF;
+	int		i;
+
+	if (len < (TELEMETRY_HEADER + TELEMETRY_CRC)) {
+		c->bad_frame++;
+		return;
+	}
+
+	for (i = 0; i < len - TELEMETRY_CRC; i++) {
+		crc = crc_update(crc, frame[i]);
+	}
+
+	if (crc != get16(frame + len - TELEMETRY_CRC)) {
+		c->bad_crc++;
+		return;
+	}
+
+	if (synced) {
+		c->lost += (uint8_t)(frame[1] - expected);
+	}
+	synced = true;
+	expected = frame[1] + 1;
+	c->good++;
+
+	if (!quiet) {
+		print_frame(frame, len);
+	}
+}
+
+
+static speed_t
+baud_to_speed(long baud)
+{
+	switch (baud) {
+	case 9600:	return B9600;
+	case 19200:	return B19200;
+	case 38400:	return B38400;
+	case 57600:	return B57600;
+	case 115200:	return B115200;
+#ifdef B500000
+	case 500000:	return B500000;
+#endif
+#ifdef B1000000
+	case 1000000:	return B1000000;
+#endif
+#ifdef B2000000
+	case 2000000:	return B2000000;
+#endif
+	}
+
+	return 0;
+}
+
+
+static int
+open_port(const char *path, long baud)
+{
+	struct termios	tio;
+	speed_t		speed;
+	int		fd;
+
+	if ((speed = baud_to_speed(baud)) == 0) {
+		fprintf(stderr, "teldecode: unsupported baud rate %ld\n", baud);
+		return -1;
+	}
+
+	if ((fd = open(path, O_RDONLY | O_NOCTTY)) == -1) {
+		fprintf(stderr, "teldecode: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (tcgetattr(fd, &tio) == -1) {
+		fprintf(stderr, "teldecode: %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSANOW, &tio) == -1) {
+		fprintf(stderr, "teldecode: %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	struct counters	c;
+	uint8_t		raw[256], frame[TELEMETRY_MAX_FRAME];
+	uint8_t		buf[512];
+	size_t		rawlen = 0;
+	bool		quiet = false, overlong = false;
+	long		baud = 9600;
+	ssize_t		n, i;
+	int		ch, fd = STDIN_FILENO, len;
+
+	while ((ch = getopt(argc, argv, "b:q")) != -1) {
+		switch (ch) {
+		case 'b':
+			baud = strtol(optarg, NULL, 10);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			fprintf(stderr, "usage: teldecode [-q] [-b baud] "
+			    "[device]\n");
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 0 && (fd = open_port(argv[0], baud)) == -1) {
+		return 1;
+	}
+
+	signal(SIGINT, stop);
+	memset(&c, 0, sizeof(c));
+
+	while (!done && (n = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (buf[i] != 0) {
+				if (rawlen < sizeof(raw)) {
+					raw[rawlen++] = buf[i];
+				}
+				else {
+					overlong = true;
+				}
+				continue;
+			}
+
+			/*
+			 * A zero ends the frame. Back-to-back zeros are
+			 * just idle line, not empty frames.
+			 */
+			if (rawlen == 0) {
+				continue;
+			}
+
+			len = cobs_decode(raw, rawlen, frame, sizeof(frame));
+			if (overlong || len < 0) {
+				c.bad_frame++;
+			}
+			else {
+				check_frame(frame, len, quiet, &c);
+			}
+
+			fflush(stdout);
+			rawlen = 0;
+			overlong = false;
+		}
+	}
+
+	printf("%lu good, %lu bad CRC, %lu malformed, %lu lost\n",
+	    c.good, c.bad_crc, c.bad_frame, c.lost);
+
+	return 0;
+}